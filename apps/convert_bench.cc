@@ -0,0 +1,180 @@
+#include "exception.hh"
+#include "scale.hh"
+#include "synthetic_source.hh"
+#include "timer.hh"
+#include "yuyv_to_i420.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <linux/videodev2.h>
+#include <span>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static constexpr unsigned int width = 2560;
+static constexpr unsigned int height = 720;
+
+static constexpr size_t luma_size = width * height;
+static constexpr size_t chroma_size = ( width / 2 ) * ( height / 2 );
+
+/* time `convert` over `iterations` frames, report mean and best */
+template<class Function>
+double time_conversion( const string_view name, const unsigned int iterations, Function&& convert )
+{
+  Timer::Record record {};
+  for ( unsigned int i = 0; i < iterations; i++ ) {
+    const uint64_t start = Timer::timestamp_ns();
+    convert();
+    record.log( Timer::timestamp_ns() - start );
+  }
+
+  const double mean_ns = double( record.total_ns ) / record.count;
+  cout << "   " << name << ":" << string( 10 - min( size_t( 10 ), name.size() ), ' ' ) << "mean ";
+  Timer::pp_ns( cout, mean_ns );
+  cout << "  best ";
+  Timer::pp_ns( cout, record.min_ns );
+  cout << "  (" << fixed << setprecision( 0 ) << 2 * luma_size / ( mean_ns / 1000 ) << " MB/s of YUYV in)";
+  return mean_ns;
+}
+
+/* compare one plane with the reference */
+void compare_plane( const string_view plane_name, span<const uint8_t> reference, span<const uint8_t> candidate )
+{
+  uint64_t squared_error = 0;
+  size_t differing = 0;
+  unsigned int max_difference = 0;
+
+  for ( size_t i = 0; i < reference.size(); i++ ) {
+    const int difference = int( reference[i] ) - int( candidate[i] );
+    if ( difference ) {
+      differing++;
+      max_difference = max( max_difference, static_cast<unsigned int>( abs( difference ) ) );
+      squared_error += difference * difference;
+    }
+  }
+
+  cout << "      " << plane_name << ": ";
+  if ( differing == 0 ) {
+    cout << "bit-exact\n";
+    return;
+  }
+
+  const double mse = double( squared_error ) / reference.size();
+  cout << differing << " of " << reference.size() << " samples differ (max " << max_difference
+       << "), PSNR = " << fixed << setprecision( 2 ) << 10 * log10( 255.0 * 255.0 / mse ) << " dB\n";
+}
+
+void bench( const unsigned int iterations )
+{
+  SyntheticSource source { width, height, V4L2_PIX_FMT_YUYV, 30, false };
+  const FramePlanes frame = source.borrow_next_planes();
+
+  cout << "YUYV => I420 at " << width << "x" << height << ", " << iterations << " iterations\n\n";
+
+  /* reference: swscale */
+  ColorspaceConverter swscale { width, height, { .force_swscale = true } };
+  vector<uint8_t> reference( luma_size + 2 * chroma_size );
+  time_conversion( "swscale", iterations, [&] { swscale.convert( frame, reference ); } );
+  cout << "\n";
+
+  vector<pair<YUYVToI420::Kernel, vector<uint8_t>>> outputs;
+  for ( const auto kernel : { YUYVToI420::Kernel::Scalar, YUYVToI420::Kernel::SSE2, YUYVToI420::Kernel::AVX2 } ) {
+    if ( not YUYVToI420::supported( kernel ) ) {
+      cout << "   " << YUYVToI420::name( kernel ) << ": not supported on this CPU\n";
+      continue;
+    }
+
+    auto& output = outputs.emplace_back( kernel, vector<uint8_t>( reference.size() ) ).second;
+    const YUYVToI420::Destination dest { output.data(),
+                                         output.data() + luma_size,
+                                         output.data() + luma_size + chroma_size,
+                                         width,
+                                         width / 2,
+                                         width / 2 };
+    time_conversion( YUYVToI420::name( kernel ), iterations, [&] {
+      YUYVToI420::convert( kernel, frame.planes[0].data, frame.planes[0].stride, dest, width, height );
+    } );
+    cout << "\n";
+  }
+
+  cout << "\nAgreement with swscale:\n";
+  const span<const uint8_t> ref { reference };
+  for ( const auto& [kernel, output] : outputs ) {
+    const span<const uint8_t> out { output };
+    cout << "   " << YUYVToI420::name( kernel ) << ":\n";
+    compare_plane( "Y", ref.subspan( 0, luma_size ), out.subspan( 0, luma_size ) );
+    compare_plane( "U", ref.subspan( luma_size, chroma_size ), out.subspan( luma_size, chroma_size ) );
+    compare_plane( "V", ref.subspan( luma_size + chroma_size ), out.subspan( luma_size + chroma_size ) );
+  }
+
+  cout << "\nDefault engine: " << ColorspaceConverter( width, height ).engine() << "\n";
+}
+
+/* the same conversion split into horizontal bands across 1..max_threads threads */
+void bench_threads( const unsigned int iterations, const unsigned int max_threads, const bool force_swscale )
+{
+  SyntheticSource source { width, height, V4L2_PIX_FMT_YUYV, 30, false };
+  const FramePlanes frame = source.borrow_next_planes();
+
+  vector<uint8_t> single_threaded( luma_size + 2 * chroma_size );
+  ColorspaceConverter { width, height, { .force_swscale = force_swscale } }.convert( frame, single_threaded );
+
+  cout << "\n" << ColorspaceConverter( width, height, { .force_swscale = force_swscale } ).engine()
+       << " by thread count:\n";
+
+  double one_thread_ns = 0;
+  for ( unsigned int num_threads = 1; num_threads <= max_threads; num_threads++ ) {
+    const ColorspaceConverter converter { width, height, { force_swscale, num_threads } };
+    vector<uint8_t> output( single_threaded.size() );
+
+    const double mean_ns = time_conversion( to_string( num_threads ) + " thr", iterations, [&] {
+      converter.convert( frame, output );
+    } );
+    if ( num_threads == 1 ) {
+      one_thread_ns = mean_ns;
+    }
+
+    cout << "  speedup " << fixed << setprecision( 2 ) << one_thread_ns / mean_ns << "x"
+         << ( output == single_threaded ? "" : "  OUTPUT DIFFERS FROM 1 THREAD" ) << "\n";
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+
+    if ( args.size() > 3 ) {
+      cerr << "Usage: " << args.front() << " [iterations] [max_threads]\n";
+      return EXIT_FAILURE;
+    }
+
+    const unsigned int iterations = args.size() >= 2 ? stoul( args[1] ) : 200;
+    if ( iterations == 0 ) {
+      throw runtime_error( "need at least one iteration" );
+    }
+
+    const unsigned int max_threads = args.size() >= 3 ? stoul( args[2] ) : 8;
+    if ( max_threads == 0 ) {
+      throw runtime_error( "need at least one thread" );
+    }
+
+    bench( iterations );
+    cout << "\n(" << thread::hardware_concurrency() << " hardware threads)\n";
+    bench_threads( iterations, max_threads, false );
+    bench_threads( iterations, max_threads, true );
+  } catch ( const exception& e ) {
+    cerr << "Died on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#include "exception.hh"
+#include "h264_encoder.hh"
+#include "histogram.hh"
+#include "scale.hh"
+#include "synthetic_source.hh"
+#include "timer.hh"
+
+#include <iomanip>
+#include <iostream>
+#include <linux/videodev2.h>
+#include <span>
+#include <vector>
+
+using namespace std;
+
+static constexpr unsigned int width = 2560;
+static constexpr unsigned int height = 720;
+static constexpr unsigned int fps = 30;
+
+struct PathResult
+{
+  string name;
+  LatencyHistogram latency {};
+  uint64_t cpu_ns {};
+  uint64_t encoded_bytes {};
+
+  uint64_t cpu_per_frame() const { return cpu_ns / latency.count(); }
+
+  void print( ostream& out ) const
+  {
+    out << name << ":\n   latency/frame: mean ";
+    Timer::pp_ns( out, latency.mean_ns() );
+    out << "  p50 ";
+    Timer::pp_ns( out, latency.percentile_ns( 0.5 ) );
+    out << "  p99 ";
+    Timer::pp_ns( out, latency.percentile_ns( 0.99 ) );
+    out << "\n   CPU/frame:     ";
+    Timer::pp_ns( out, cpu_per_frame() );
+    out << "\n   encoded:       " << encoded_bytes / latency.count() << " bytes/frame\n";
+  }
+};
+
+/* times `per_frame` (which should convert and/or encode, returning the encoded size) on `num_frames` synthetic YUYV frames */
+template<class Function>
+PathResult run_path( const string& name, const unsigned int num_frames, Function&& per_frame )
+{
+  SyntheticSource source { width, height, V4L2_PIX_FMT_YUYV, fps, false };
+  PathResult result { name };
+
+  for ( unsigned int i = 0; i < num_frames; i++ ) {
+    const FramePlanes frame = source.borrow_next_planes();
+
+    const uint64_t cpu_before = Timer::process_cpu_ns();
+    const uint64_t start = Timer::timestamp_ns();
+    result.encoded_bytes += per_frame( frame );
+    result.latency.record( Timer::timestamp_ns() - start );
+    result.cpu_ns += Timer::process_cpu_ns() - cpu_before;
+
+    source.release_frame();
+  }
+
+  return result;
+}
+
+void print_saving( const string_view what, const uint64_t before, const uint64_t after )
+{
+  cout << "   " << what << ": ";
+  if ( after <= before ) {
+    Timer::pp_ns( cout, before - after );
+    cout << " saved";
+  } else {
+    Timer::pp_ns( cout, after - before );
+    cout << " extra";
+  }
+  cout << " (" << fixed << setprecision( 1 ) << 100.0 * ( double( before ) - double( after ) ) / before << "%)\n";
+}
+
+void bench( const unsigned int num_frames )
+{
+  cout << "Encoding " << num_frames << " synthetic " << width << "x" << height << " YUYV frames per path\n\n";
+
+  ColorspaceConverter converter { width, height };
+  vector<uint8_t> frame420( 3 * width * height / 2 );
+
+  H264Encoder::Config config420;
+  H264Encoder enc420 { width, height, fps, config420 };
+  const string converted_name = string( converter.engine() ) + " YUYV->I420 + 4:2:0 encode";
+  const PathResult converted = run_path( converted_name, num_frames, [&]( auto& frame ) {
+    return enc420.encode420( converter.convert( frame, frame420 ) ).size();
+  } );
+  converted.print( cout );
+
+  H264Encoder::Config config422;
+  config422.chroma_422 = true;
+  H264Encoder enc422 { width, height, fps, config422 };
+  const PathResult direct = run_path(
+    "YUYV straight into 4:2:2 encode", num_frames, [&]( auto& frame ) { return enc422.encode422( frame ).size(); } );
+  direct.print( cout );
+
+  cout << "\nPer frame, going direct:\n";
+  print_saving( "latency (mean)", converted.latency.mean_ns(), direct.latency.mean_ns() );
+  print_saving( "latency (p99) ", converted.latency.percentile_ns( 0.99 ), direct.latency.percentile_ns( 0.99 ) );
+  print_saving( "CPU           ", converted.cpu_per_frame(), direct.cpu_per_frame() );
+  cout << "   (4:2:2 also carries twice the chroma: " << direct.encoded_bytes / num_frames << " vs "
+       << converted.encoded_bytes / num_frames << " bytes/frame)\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+
+    if ( args.size() > 2 ) {
+      cerr << "Usage: " << args.front() << " [frames]\n";
+      return EXIT_FAILURE;
+    }
+
+    const unsigned int num_frames = args.size() == 2 ? stoul( args[1] ) : 300;
+    if ( num_frames == 0 ) {
+      throw runtime_error( "need at least one frame" );
+    }
+
+    bench( num_frames );
+  } catch ( const exception& e ) {
+    cerr << "Died on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
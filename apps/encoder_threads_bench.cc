@@ -0,0 +1,157 @@
+#include "exception.hh"
+#include "h264_encoder.hh"
+#include "histogram.hh"
+#include "synthetic_source.hh"
+#include "timer.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <linux/videodev2.h>
+#include <span>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static constexpr unsigned int width = 2560;
+static constexpr unsigned int height = 720;
+static constexpr unsigned int fps = 30;
+
+static vector<string> split( const string_view list )
+{
+  vector<string> ret;
+  stringstream ss { string( list ) };
+  string item;
+  while ( getline( ss, item, ',' ) ) {
+    ret.push_back( item == "-" ? "" : item );
+  }
+  return ret;
+}
+
+struct Setting
+{
+  string preset, tune;
+  H264Encoder::Config::Threading threading;
+  unsigned int threads, lookahead_threads;
+};
+
+static string_view threading_name( const H264Encoder::Config::Threading threading )
+{
+  switch ( threading ) {
+    case H264Encoder::Config::Threading::Default:
+      return "default";
+    case H264Encoder::Config::Threading::Sliced:
+      return "sliced";
+    case H264Encoder::Config::Threading::Frame:
+      return "frame";
+  }
+  return "?";
+}
+
+static string count_name( const unsigned int count )
+{
+  return count ? to_string( count ) : "auto";
+}
+
+/* encodes `num_frames` unpaced synthetic frames; latency is from handing a picture to the encoder until its
+   output comes back (so it includes the pictures frame threading holds on to) */
+void run( const Setting& setting, const unsigned int num_frames, const unsigned int cores )
+{
+  H264Encoder::Config config;
+  config.preset = setting.preset;
+  config.tune = setting.tune;
+  config.threading = setting.threading;
+  config.threads = setting.threads;
+  config.lookahead_threads = setting.lookahead_threads;
+
+  SyntheticSource source { width, height, V4L2_PIX_FMT_YUV420, fps, false };
+  H264Encoder encoder { width, height, fps, config };
+  LatencyHistogram latency;
+
+  const uint64_t cpu_before = Timer::process_cpu_ns();
+  const uint64_t start = Timer::timestamp_ns();
+
+  for ( unsigned int i = 0; i < num_frames; i++ ) {
+    const EncodedFrame& frame = encoder.encode( source.borrow_next_planes() );
+    source.release_frame();
+
+    if ( not frame.empty() ) {
+      latency.record( Timer::timestamp_ns() - frame.capture_timestamp );
+    }
+  }
+
+  const double elapsed_s = ( Timer::timestamp_ns() - start ) / double( BILLION );
+  const double cpu_s = ( Timer::process_cpu_ns() - cpu_before ) / double( BILLION );
+
+  cout << left << setw( 10 ) << setting.preset << setw( 12 ) << ( setting.tune.empty() ? "-" : setting.tune )
+       << setw( 10 ) << threading_name( setting.threading ) << setw( 8 ) << count_name( setting.threads )
+       << setw( 10 ) << count_name( setting.lookahead_threads ) << right << fixed << setprecision( 1 ) << setw( 7 )
+       << latency.count() / elapsed_s << " ";
+  Timer::pp_ns( cout, latency.percentile_ns( 0.5 ) );
+  cout << " ";
+  Timer::pp_ns( cout, latency.percentile_ns( 0.99 ) );
+  cout << setw( 7 ) << setprecision( 2 ) << cpu_s / elapsed_s << setw( 6 ) << setprecision( 0 )
+       << 100 * cpu_s / elapsed_s / cores << "%\n";
+}
+
+void bench( const unsigned int num_frames, const vector<string>& presets, const vector<string>& tunes )
+{
+  const unsigned int cores = max( 1u, thread::hardware_concurrency() );
+
+  vector<unsigned int> thread_counts { 1, 2, 4 };
+  if ( cores > 4 ) {
+    thread_counts.push_back( cores );
+  }
+  thread_counts.push_back( 0 );
+
+  cout << "Encoding " << num_frames << " synthetic " << width << "x" << height << " frames per setting, " << cores
+       << " cores\n\n";
+  cout << "preset    tune        threading threads lookahead     fps     p50        p99       cores  util\n";
+
+  using Threading = H264Encoder::Config::Threading;
+
+  for ( const auto& preset : presets ) {
+    for ( const auto& tune : tunes ) {
+      for ( const auto threading : { Threading::Sliced, Threading::Frame } ) {
+        for ( const auto threads : thread_counts ) {
+          for ( const auto lookahead_threads : { 0u, 1u } ) {
+            run( { preset, tune, threading, threads, lookahead_threads }, num_frames, cores );
+          }
+        }
+      }
+    }
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+
+    if ( args.size() > 4 ) {
+      cerr << "Usage: " << args.front() << " [frames] [preset,...] [tune,... (\"-\" for none)]\n";
+      return EXIT_FAILURE;
+    }
+
+    const unsigned int num_frames = args.size() >= 2 ? stoul( args[1] ) : 150;
+    const vector<string> presets = split( args.size() >= 3 ? args[2] : "ultrafast,veryfast" );
+    const vector<string> tunes = split( args.size() >= 4 ? args[3] : "zerolatency,-" );
+
+    if ( num_frames == 0 or presets.empty() or tunes.empty() ) {
+      throw runtime_error( "need at least one frame, preset and tune" );
+    }
+
+    bench( num_frames, presets, tunes );
+  } catch ( const exception& e ) {
+    cerr << "Died on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
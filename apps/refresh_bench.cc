@@ -0,0 +1,229 @@
+#include "exception.hh"
+#include "h264_encoder.hh"
+#include "histogram.hh"
+#include "synthetic_source.hh"
+#include "timer.hh"
+#include "video_source.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <linux/videodev2.h>
+#include <numeric>
+#include <span>
+#include <vector>
+
+using namespace std;
+
+static constexpr unsigned int width = 2560;
+static constexpr unsigned int height = 720;
+static constexpr unsigned int fps = 30;
+static constexpr uint64_t frame_interval = 1'000'000'000 / fps;
+
+static constexpr uint64_t send_step = 100'000; /* how often the simulated sender looks for something to send */
+
+struct Distribution
+{
+  vector<double> values {};
+
+  double mean() const { return accumulate( values.begin(), values.end(), 0.0 ) / values.size(); }
+
+  double stddev() const
+  {
+    const double m = mean();
+    double sum = 0;
+    for ( const double v : values ) {
+      sum += ( v - m ) * ( v - m );
+    }
+    return sqrt( sum / values.size() );
+  }
+
+  double max() const { return *max_element( values.begin(), values.end() ); }
+};
+
+struct RefreshResult
+{
+  string name;
+  Distribution frame_bytes {};
+  LatencyHistogram queue_drain_time {}; /* the queued bytes, as the time to send them at the link rate */
+  unsigned int keyframes {}, frames_superseded {};
+};
+
+/* encodes `num_frames` synthetic frames and feeds them to a VideoSource in simulated time, drained by a
+   sender with a `link_mbps` budget; samples the queue depth as each frame arrives */
+RefreshResult run( const string& name,
+                   const H264Encoder::Config& config,
+                   const unsigned int num_frames,
+                   const double link_mbps )
+{
+  SyntheticSource frames { width, height, V4L2_PIX_FMT_YUV420, fps, false };
+  H264Encoder encoder { width, height, fps, config };
+  VideoSource source;
+  source.set_pacing_rate( link_mbps * 1'000'000, 0 );
+  RefreshResult result { name };
+
+  const uint64_t packet_time = 8 * max_chunk_size( default_mtu ) * 1000 / link_mbps;
+  uint64_t now = 0;
+
+  for ( unsigned int i = 0; i < num_frames; i++ ) {
+    const uint64_t frame_time = i * frame_interval;
+
+    /* send until the next frame is due */
+    while ( now < frame_time ) {
+      if ( source.ready( now ) ) {
+        source.pop_frame( now ); /* a full chunk fills a packet */
+        now += packet_time;
+      } else {
+        now += send_step;
+      }
+    }
+
+    const EncodedFrame& frame = encoder.encode( frames.borrow_next_planes() );
+    frames.release_frame();
+
+    if ( frame.empty() ) {
+      continue;
+    }
+
+    source.push( frame, frame_time );
+
+    /* every mode starts with an IDR, so leave the first frame out */
+    if ( i > 0 ) {
+      result.frame_bytes.values.push_back( frame.size() );
+      result.queue_drain_time.record( uint64_t( 8 * source.queued_bytes() * 1000 / link_mbps ) );
+      result.keyframes += frame.keyframe;
+    }
+  }
+
+  result.frames_superseded = source.frames_superseded();
+  return result;
+}
+
+/* the receiver loses a frame, and asks for recovery with every packet it sends until the recovery reaches it
+   (here, four a frame for eight frames), as the client passes each request on. Returns how many times the
+   encoder was told to recover: once, if the requests coalesce. */
+unsigned int recover_from_burst( const H264Encoder::Config& config )
+{
+  static constexpr unsigned int lost_frame = 10, burst_frames = 8, requests_per_frame = 4;
+
+  SyntheticSource frames { width, height, V4L2_PIX_FMT_YUV420, fps, false };
+  H264Encoder encoder { width, height, fps, config };
+  VideoSource source;
+  uint32_t nals_pushed = 0, last_good_nal = 0;
+  unsigned int recoveries = 0;
+
+  for ( unsigned int i = 0; i <= lost_frame + burst_frames; i++ ) {
+    const uint64_t frame_time = i * frame_interval;
+
+    for ( unsigned int r = 0; i > lost_frame and r < requests_per_frame; r++ ) {
+      source.request_recovery( last_good_nal, frame_time + r * frame_interval / requests_per_frame );
+      if ( const auto recovery = source.take_recovery() ) {
+        encoder.recover( recovery->first_lost_pts );
+        recoveries++;
+      }
+    }
+
+    const EncodedFrame& frame = encoder.encode( frames.borrow_next_planes() );
+    frames.release_frame();
+
+    if ( frame.empty() ) {
+      continue;
+    }
+
+    if ( i == lost_frame ) {
+      last_good_nal = nals_pushed - 1;
+    }
+    source.push( frame, frame_time );
+    nals_pushed += frame.slices().size();
+  }
+
+  return recoveries;
+}
+
+void print( const RefreshResult& result, const double link_mbps )
+{
+  const auto& size = result.frame_bytes;
+  const auto& queue = result.queue_drain_time;
+
+  const auto bytes = [&]( const uint64_t drain_time ) { return drain_time * link_mbps / 8000; };
+
+  cout << result.name << " (" << result.keyframes << " keyframes after the first frame, "
+       << result.frames_superseded << " queued frames superseded):\n";
+  cout << fixed << setprecision( 0 );
+  cout << "   frame size:  mean " << size.mean() << " stddev " << size.stddev() << " max " << size.max()
+       << " bytes (max/mean " << setprecision( 1 ) << size.max() / size.mean() << ", CV "
+       << setprecision( 2 ) << size.stddev() / size.mean() << ")\n";
+  cout << setprecision( 0 );
+  cout << "   send queue:  mean " << bytes( queue.mean_ns() ) << " p99 " << bytes( queue.percentile_ns( 0.99 ) )
+       << " max " << bytes( queue.max_ns() ) << " bytes\n";
+  cout << "   (to drain:   mean ";
+  Timer::pp_ns( cout, queue.mean_ns() );
+  cout << " p99 ";
+  Timer::pp_ns( cout, queue.percentile_ns( 0.99 ) );
+  cout << " max ";
+  Timer::pp_ns( cout, queue.max_ns() );
+  cout << ")\n";
+}
+
+void bench( const unsigned int num_frames, const unsigned int refresh_period, const double link_mbps )
+{
+  cout << "Encoding " << num_frames << " synthetic " << width << "x" << height << " frames, refresh every "
+       << refresh_period << " frames, sending at " << link_mbps << " Mbps\n\n";
+
+  H264Encoder::Config gop;
+  gop.refresh = H264Encoder::Config::Refresh::PeriodicIDR;
+  gop.refresh_period = refresh_period;
+  print( run( "periodic IDR", gop, num_frames, link_mbps ), link_mbps );
+
+  H264Encoder::Config intra_refresh;
+  intra_refresh.refresh = H264Encoder::Config::Refresh::IntraRefresh;
+  intra_refresh.refresh_period = refresh_period;
+  const RefreshResult refreshed = run( "intra refresh", intra_refresh, num_frames, link_mbps );
+  print( refreshed, link_mbps );
+
+  /* a recovery point refers to the frames before it, so those must all go out */
+  if ( refreshed.frames_superseded ) {
+    throw runtime_error( "intra refresh superseded queued frames that later ones refer to" );
+  }
+
+  cout << "\n";
+  for ( const auto& [name, config] : { pair { "periodic IDR", gop }, pair { "intra refresh", intra_refresh } } ) {
+    const unsigned int recoveries = recover_from_burst( config );
+    cout << name << ": a burst of recovery requests for one loss made " << recoveries << " recover() call(s)\n";
+    if ( recoveries != 1 ) {
+      throw runtime_error( string( name ) + ": a burst of recovery requests should make one recover() call" );
+    }
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+
+    if ( args.size() > 4 ) {
+      cerr << "Usage: " << args.front() << " [frames] [refresh period (frames)] [link Mbps]\n";
+      return EXIT_FAILURE;
+    }
+
+    const unsigned int num_frames = args.size() >= 2 ? stoul( args[1] ) : 300;
+    const unsigned int refresh_period = args.size() >= 3 ? stoul( args[2] ) : 2 * fps;
+    const double link_mbps = args.size() >= 4 ? stod( args[3] ) : 20;
+
+    if ( num_frames < 2 or refresh_period == 0 or link_mbps <= 0 ) {
+      throw runtime_error( "need two frames or more, and a positive refresh period and link rate" );
+    }
+
+    bench( num_frames, refresh_period, link_mbps );
+  } catch ( const exception& e ) {
+    cerr << "Died on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+#include "exception.hh"
+#include "histogram.hh"
+#include "sender.hh"
+#include "timer.hh"
+
+#include <iomanip>
+#include <iostream>
+#include <span>
+
+using namespace std;
+
+static constexpr size_t window = 8192; /* NetworkSender's frame window */
+
+/* hands NetworkSender chunks, as a VideoSource would: all small, or (mixed) every other one full-size */
+class ChunkSource
+{
+  VideoChunk chunk_ {};
+  uint16_t chunk_size_;
+  bool mixed_;
+  uint32_t nals_ {};
+
+public:
+  ChunkSource( const uint16_t chunk_size, const bool mixed ) : chunk_size_( chunk_size ), mixed_( mixed )
+  {
+    chunk_.end_of_nal = true;
+  }
+
+  VideoChunk front( const uint32_t frame_index ) const
+  {
+    VideoChunk ret = chunk_;
+    ret.frame_index = frame_index;
+    ret.nal_index = nals_;
+    ret.data.resize( mixed_ and nals_ % 2 ? max_chunk_size( default_mtu ) : chunk_size_ );
+    return ret;
+  }
+
+  void pop_frame() { nals_++; }
+};
+
+/* a receiver that SACKs every packet (but the lost ones), while holding its cumulative ACK `occupancy`
+   frames back (as if waiting on a gap), so the sender's window stays that full of acked-but-unreleased
+   frames. Times each set_sender_section. With mixed sizes and loss, full-size chunks pile up waiting for a
+   packet with room for them (one whose newest chunk is small enough). */
+void run( const unsigned int occupancy,
+          const unsigned int loss_period,
+          const uint16_t chunk_size,
+          const bool mixed,
+          const unsigned int num_packets )
+{
+  NetworkSender<VideoChunk> sender;
+  ChunkSource source { chunk_size, mixed };
+  LatencyHistogram fill_time;
+  uint64_t frames_sent = 0;
+
+  uint32_t next_frame = 0;
+  for ( unsigned int i = 0; i < occupancy + num_packets; i++ ) {
+    sender.push_frame( source );
+    next_frame++;
+
+    Packet<VideoChunk>::SenderSection sent;
+    const uint64_t start = Timer::timestamp_ns();
+    sender.set_sender_section( sent );
+    const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+    Packet<VideoChunk>::ReceiverSection ack;
+    ack.next_frame_needed = next_frame > occupancy ? next_frame - occupancy : 0;
+    if ( not loss_period or sent.sequence_number % loss_period ) {
+      ack.packets_received.push_back( sent.sequence_number );
+    }
+    sender.receive_receiver_section( ack );
+
+    if ( i >= occupancy ) {
+      fill_time.record( elapsed );
+      frames_sent += sent.frames.length;
+    }
+  }
+
+  cout << setw( 6 ) << ( mixed ? "mixed" : "small" ) << setw( 11 ) << occupancy << setw( 8 )
+       << ( loss_period ? to_string( loss_period ) : "-" ) << fixed << setprecision( 2 ) << setw( 14 )
+       << frames_sent / double( num_packets ) << "   ";
+  fill_time.summary( cout );
+  cout << "\n";
+}
+
+void bench( const uint16_t chunk_size, const unsigned int num_packets )
+{
+  cout << "Filling " << num_packets << " packets from a NetworkSender of " << chunk_size
+       << "-byte chunks (or, mixed, alternating with full-size ones), for each window occupancy (frames) and"
+          " loss period (packets)\n\n";
+  cout << "sizes  occupancy  loss 1/  frames/packet   set_sender_section time\n";
+
+  for ( const bool mixed : { false, true } ) {
+    for ( const unsigned int loss_period : { 0u, 50u, 4u } ) {
+      for ( const unsigned int occupancy : { 16u, 256u, 2048u, unsigned( window - 1 ) } ) {
+        run( occupancy, loss_period, chunk_size, mixed, num_packets );
+      }
+    }
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+
+    if ( args.size() > 3 ) {
+      cerr << "Usage: " << args.front() << " [chunk size (bytes)] [packets]\n";
+      return EXIT_FAILURE;
+    }
+
+    const unsigned long chunk_size = args.size() >= 2 ? stoul( args[1] ) : 100;
+    const unsigned int num_packets = args.size() >= 3 ? stoul( args[2] ) : 200'000;
+
+    if ( chunk_size == 0 or chunk_size > max_chunk_size( default_mtu ) or num_packets == 0 ) {
+      throw runtime_error( "chunk size must be from 1 to " + to_string( max_chunk_size( default_mtu ) )
+                           + " bytes, and packets positive" );
+    }
+
+    bench( chunk_size, num_packets );
+  } catch ( const exception& e ) {
+    cerr << "Died on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+#include "exception.hh"
+#include "formats.hh"
+#include "h264_encoder.hh"
+#include "histogram.hh"
+#include "synthetic_source.hh"
+#include "timer.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <linux/videodev2.h>
+#include <random>
+#include <span>
+#include <vector>
+
+using namespace std;
+
+static constexpr unsigned int width = 2560;
+static constexpr unsigned int height = 720;
+static constexpr unsigned int fps = 30;
+static constexpr uint64_t frame_interval = 1'000'000'000 / fps;
+
+static constexpr size_t chunk_size = max_chunk_size( default_mtu );
+static constexpr unsigned int chunks_per_packet = 1; /* a full chunk fills a packet */
+
+/* a lossy path: each packet is lost independently, and a loss costs one more RTT to repair */
+struct Path
+{
+  double loss_rate;
+  uint64_t rtt_ns { 40'000'000 };
+  double link_mbps { 50 };
+
+  uint64_t packet_time_ns() const { return 8 * chunks_per_packet * chunk_size * 1000 / link_mbps; }
+};
+
+/* encoder output: each frame as the pieces it would be sent in */
+using EncodedVideo = vector<vector<string>>;
+
+EncodedVideo encode_video( const unsigned int num_frames,
+                           const H264Encoder::Config& config,
+                           const bool nal_per_slice )
+{
+  SyntheticSource source { width, height, V4L2_PIX_FMT_YUV420, fps, false };
+  H264Encoder encoder { width, height, fps, config };
+  EncodedVideo ret;
+
+  for ( unsigned int i = 0; i < num_frames; i++ ) {
+    const EncodedFrame& frame = encoder.encode( source.borrow_next_planes() );
+    source.release_frame();
+
+    if ( frame.empty() ) {
+      continue;
+    }
+
+    auto& pieces = ret.emplace_back();
+    if ( nal_per_slice ) {
+      for ( const auto slice : frame.slices() ) {
+        pieces.emplace_back( slice );
+      }
+    } else {
+      pieces.emplace_back( frame.payload );
+    }
+  }
+
+  return ret;
+}
+
+struct LossResult
+{
+  LatencyHistogram nal_usable {}, frame_complete {};
+  uint64_t bytes {}, bytes_delayed {}, nals {}, packets {};
+  double byte_weighted_wait_ns {};
+
+  void print( const string_view name, const size_t num_frames ) const
+  {
+    cout << name << ":\n";
+    cout << "   " << bytes / num_frames << " bytes/frame in " << fixed << setprecision( 1 )
+         << double( nals ) / num_frames << " NALs, " << double( packets ) / num_frames << " packets\n";
+    cout << "   NAL usable:     ";
+    nal_usable.summary( cout );
+    cout << "\n   frame complete: ";
+    frame_complete.summary( cout );
+    cout << "\n   mean wait per byte: ";
+    Timer::pp_ns( cout, byte_weighted_wait_ns / bytes );
+    cout << ", held up by a lost packet: " << setprecision( 1 ) << 100.0 * bytes_delayed / bytes << "%\n";
+  }
+};
+
+/* sends each frame's NALs back to back in packets of `chunks_per_packet` chunks (a NAL always starts a new
+   chunk), and times when each NAL, and each whole frame, would be complete at the receiver */
+LossResult simulate( const EncodedVideo& video, const Path& path, const uint64_t seed )
+{
+  mt19937_64 rng { seed };
+  bernoulli_distribution lost { path.loss_rate };
+
+  LossResult result;
+  uint64_t link_free = 0;
+
+  for ( size_t frame_no = 0; frame_no < video.size(); frame_no++ ) {
+    const uint64_t frame_time = frame_no * frame_interval;
+    const uint64_t start = max( frame_time, link_free );
+
+    /* when each of this frame's packets arrives, and whether it had to be retransmitted */
+    vector<pair<uint64_t, bool>> arrivals;
+    const auto packet_for_chunk = [&]( const size_t chunk ) -> const pair<uint64_t, bool>& {
+      while ( arrivals.size() <= chunk / chunks_per_packet ) {
+        unsigned int losses = 0;
+        while ( lost( rng ) ) {
+          losses++;
+        }
+        const uint64_t sent = start + arrivals.size() * path.packet_time_ns();
+        arrivals.emplace_back( sent + path.rtt_ns / 2 + losses * path.rtt_ns, losses > 0 );
+      }
+      return arrivals.at( chunk / chunks_per_packet );
+    };
+
+    size_t next_chunk = 0;
+    uint64_t frame_done = 0;
+    for ( const auto& nal : video[frame_no] ) {
+      const size_t num_chunks = ( nal.size() + chunk_size - 1 ) / chunk_size;
+
+      uint64_t nal_done = 0;
+      bool delayed = false;
+      for ( size_t i = 0; i < num_chunks; i++ ) {
+        const auto& [arrival, retransmitted] = packet_for_chunk( next_chunk++ );
+        nal_done = max( nal_done, arrival );
+        delayed |= retransmitted;
+      }
+
+      result.nal_usable.record( nal_done - frame_time );
+      result.byte_weighted_wait_ns += double( nal.size() ) * ( nal_done - frame_time );
+      result.bytes += nal.size();
+      result.bytes_delayed += delayed ? nal.size() : 0;
+      result.nals++;
+      frame_done = max( frame_done, nal_done );
+    }
+
+    result.frame_complete.record( frame_done - frame_time );
+    result.packets += arrivals.size();
+    link_free = start + arrivals.size() * path.packet_time_ns();
+  }
+
+  return result;
+}
+
+void bench( const unsigned int num_frames, const double loss_rate, const unsigned int chunks_per_slice )
+{
+  const Path path { loss_rate };
+  cout << "Sending " << num_frames << " synthetic " << width << "x" << height << " frames over a "
+       << path.link_mbps << " Mbps path, RTT ";
+  Timer::pp_ns( cout, path.rtt_ns );
+  cout << ", " << fixed << setprecision( 1 ) << 100 * loss_rate << "% packet loss\n";
+  cout << "(" << chunk_size << "-byte chunks, " << chunks_per_packet << " per packet)\n\n";
+
+  static constexpr uint64_t seed = 0x5EED;
+
+  const H264Encoder::Config sliced_threads {};
+  const EncodedVideo whole = encode_video( num_frames, sliced_threads, false );
+  simulate( whole, path, seed ).print( "one NAL per frame", whole.size() );
+
+  const EncodedVideo threads = encode_video( num_frames, sliced_threads, true );
+  simulate( threads, path, seed ).print( "one NAL per slice (a slice per encoder thread)", threads.size() );
+
+  H264Encoder::Config capped;
+  capped.slice_max_size = chunks_per_slice * chunk_size;
+  const EncodedVideo sized = encode_video( num_frames, capped, true );
+  simulate( sized, path, seed )
+    .print( "one NAL per slice (slices of at most " + to_string( chunks_per_slice ) + " chunks)", sized.size() );
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+
+    if ( args.size() > 4 ) {
+      cerr << "Usage: " << args.front() << " [frames] [loss %] [chunks per slice]\n";
+      return EXIT_FAILURE;
+    }
+
+    const unsigned int num_frames = args.size() >= 2 ? stoul( args[1] ) : 300;
+    const double loss_rate = args.size() >= 3 ? stod( args[2] ) / 100 : 0.02;
+    const unsigned int chunks_per_slice = args.size() >= 4 ? stoul( args[3] ) : 4;
+
+    if ( num_frames == 0 or chunks_per_slice == 0 ) {
+      throw runtime_error( "need at least one frame and one chunk per slice" );
+    }
+
+    if ( loss_rate < 0 or loss_rate >= 1 ) {
+      throw runtime_error( "loss must be in [0, 100)" );
+    }
+
+    bench( num_frames, loss_rate, chunks_per_slice );
+  } catch ( const exception& e ) {
+    cerr << "Died on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,9 +1,17 @@
 #include "camera.hh"
 #include "eventloop.hh"
 #include "exception.hh"
+#include "file_source.hh"
+#include "encoder_thread.hh"
 #include "h264_encoder.hh"
+#include "overload_controller.hh"
 #include "scale.hh"
+#include "simulcast_encoder.hh"
+#include "static_scene.hh"
 #include "stats_printer.hh"
+#include "synthetic_source.hh"
+#include "threaded_camera.hh"
+#include "tiled_encoder.hh"
 
 #include <iostream>
 #include <span>
@@ -14,28 +22,222 @@ static constexpr unsigned int width = 2560;
 static constexpr unsigned int height = 720;
 static constexpr unsigned int fps = 30;
 
-void camera_demo( const string& device_name )
+struct Options
 {
-  auto cam = make_shared<Camera>( width, height, device_name, V4L2_PIX_FMT_YUYV, fps );
+  string source_name {};
+  bool paced { true };
+  bool encode_yuyv { false }; /* feed YUYV frames to a 4:2:2 encoder without converting */
+  unsigned int convert_threads { 1 };
+  unsigned int encoder_threads { 0 }; /* 0: x264 picks */
+  bool capture_thread { false }; /* dequeue camera frames on their own thread */
+  unsigned int bitrate_kbps { 0 }; /* 0: constant QP */
+  bool intra_refresh { false };    /* instead of periodic IDRs */
+  bool encode_thread { false };    /* encode off the event loop's thread */
+  bool adaptive_fps { false };     /* skip frames when encoding can't keep up */
+  bool skip_static { false };      /* skip frames that haven't changed */
+  unsigned int tiles { 1 };        /* independent encoders, side by side */
+  bool simulcast { false };        /* full, half and quarter size layers */
+};
+
+shared_ptr<FrameSource> make_source( const Options& options )
+{
+  const string& name = options.source_name;
+  const bool paced = options.paced;
+
+  if ( name == "synthetic" ) {
+    return make_shared<SyntheticSource>( width, height, V4L2_PIX_FMT_YUYV, fps, paced );
+  } else if ( name.ends_with( ".y4m" ) ) {
+    return make_shared<FileSource>( name, paced );
+  } else if ( name.ends_with( ".yuyv" ) ) {
+    return make_shared<FileSource>( name, width, height, V4L2_PIX_FMT_YUYV, fps, paced );
+  } else if ( name.ends_with( ".i420" ) ) {
+    return make_shared<FileSource>( name, width, height, V4L2_PIX_FMT_YUV420, fps, paced );
+  }
+
+  /* prefer formats the encoder can take as they are */
+  const vector<uint32_t> formats = options.encode_yuyv ? vector<uint32_t> { V4L2_PIX_FMT_YUYV }
+                                                       : vector<uint32_t> { V4L2_PIX_FMT_NV12,
+                                                                            V4L2_PIX_FMT_YUV420,
+                                                                            V4L2_PIX_FMT_NV12M,
+                                                                            V4L2_PIX_FMT_YUV420M,
+                                                                            V4L2_PIX_FMT_YUYV };
+
+  auto camera = make_unique<Camera>( width, height, name, formats, fps );
+  if ( options.capture_thread ) {
+    return make_shared<ThreadedCamera>( move( camera ) );
+  }
+  return camera;
+}
+
+void capture_demo( const Options& options )
+{
+  auto source = make_source( options );
   auto loop = make_shared<EventLoop>();
   StatsPrinterTask stats { loop };
-  stats.add( cam );
-  ColorspaceConverter converter { width, height };
-  H264Encoder enc { width, height, fps, "veryfast", "zerolatency" };
-  vector<uint8_t> frame420( 3 * width * height / 2, 0 );
-
-  loop->add_rule( "get+convert+encode frame", cam->fd(), Direction::In, [&] {
-    auto the_frame_view = cam->borrow_most_recent_frame();
-    if ( not the_frame_view.empty() ) {
-      converter.convert( the_frame_view, frame420 );
-      enc.encode420( frame420 );
-    }
-    cam->release_frame();
+  stats.add( source );
+  ColorspaceConverter converter { source->width(), source->height(), { .num_threads = options.convert_threads } };
+
+  H264Encoder::Config config;
+  config.chroma_422 = options.encode_yuyv;
+  config.threads = options.encoder_threads;
+  if ( options.bitrate_kbps ) {
+    config.rate_control = H264Encoder::Config::RateControl::CappedCRF;
+    config.target_bitrate_kbps = options.bitrate_kbps;
+  }
+  if ( options.intra_refresh ) {
+    config.refresh = H264Encoder::Config::Refresh::IntraRefresh;
+  }
+  if ( config.chroma_422 and source->pixel_format() != V4L2_PIX_FMT_YUYV ) {
+    throw runtime_error( "YUYV encoding needs a YUYV source" );
+  }
+  if ( ( options.tiles > 1 or options.simulcast ) and options.encode_thread ) {
+    throw runtime_error( "--tiles and --simulcast already encode off the event loop's thread" );
+  }
+  if ( options.tiles > 1 and options.simulcast ) {
+    throw runtime_error( "--tiles and --simulcast don't go together" );
+  }
+
+  unique_ptr<H264Encoder> enc;
+  unique_ptr<TiledEncoder> tiled;
+  shared_ptr<SimulcastEncoder> simulcast;
+  if ( options.tiles > 1 ) {
+    tiled = make_unique<TiledEncoder>( source->width(), source->height(), fps, options.tiles, config );
+  } else if ( options.simulcast ) {
+    simulcast = make_shared<SimulcastEncoder>( source->width(),
+                                               source->height(),
+                                               source->pixel_format(),
+                                               fps,
+                                               SimulcastEncoder::Config { .encoder = config } );
+    stats.add( simulcast );
+  } else {
+    enc = make_unique<H264Encoder>( source->width(), source->height(), fps, config );
+  }
+  vector<uint8_t> frame420( 3 * source->width() * source->height() / 2, 0 );
+
+  shared_ptr<OverloadController> overload;
+  if ( options.adaptive_fps ) {
+    overload = make_shared<OverloadController>( OverloadController::Config { .max_fps = fps } );
+    stats.add( overload );
+  }
+
+  shared_ptr<StaticSceneDetector> static_scene;
+  if ( options.skip_static ) {
+    static_scene = make_shared<StaticSceneDetector>();
+    stats.add( static_scene );
+  }
+
+  shared_ptr<EncoderThread> encoder_thread;
+
+  /* make a call on every encoder */
+  const auto each_encoder = [&]( const function<void( H264Encoder& )>& call ) {
+    if ( encoder_thread ) {
+      encoder_thread->post( call );
+    } else if ( tiled ) {
+      for ( unsigned int i = 0; i < tiled->num_tiles(); i++ ) {
+        call( tiled->tile( i ) );
+      }
+    } else if ( simulcast ) {
+      for ( unsigned int i = 0; i < simulcast->num_layers(); i++ ) {
+        call( simulcast->layer_encoder( i ) );
+      }
+    } else {
+      call( *enc );
+    }
+  };
+
+  /* follow the encode time, and tell the encoder when the frame rate changes */
+  const auto encoded = [&]( const EncodedFrame& frame ) {
+    if ( frame.empty() ) {
+      return;
+    }
+
+    if ( static_scene ) {
+      static_scene->record_encoded( frame );
+    }
+
+    if ( not overload ) {
+      return;
+    }
+
+    if ( const auto new_fps = overload->record_encode( frame.encode_duration, Timer::timestamp_ns() ) ) {
+      each_encoder( [fps = new_fps.value()]( H264Encoder& e ) { e.set_frame_rate( fps ); } );
+    }
+  };
+
+  if ( options.encode_thread ) {
+    encoder_thread = make_shared<EncoderThread>( move( enc ) );
+    stats.add( encoder_thread );
+    loop->add_rule( "collect encoded frames", encoder_thread->fd(), Direction::In, [&] {
+      encoder_thread->drain( encoded );
+    } );
+  }
+
+  const auto encode = [&]( const FramePlanes& frame ) {
+    if ( encoder_thread ) {
+      encoder_thread->push( frame );
+    } else if ( tiled ) {
+      for ( const EncodedFrame* tile : tiled->encode( frame ) ) {
+        encoded( *tile );
+      }
+    } else if ( simulcast ) {
+      for ( const EncodedFrame* layer : simulcast->encode( frame ) ) {
+        encoded( *layer );
+      }
+    } else {
+      encoded( enc->encode( frame ) );
+    }
+  };
+
+  /* the frame interval passes without a picture */
+  const auto skip = [&] { each_encoder( []( H264Encoder& e ) { e.skip_frame(); } ); };
+
+  loop->add_rule( "get+convert+encode frame", source->fd(), Direction::In, [&] {
+    const FramePlanes frame = source->borrow_most_recent_planes();
+    if ( frame.empty() ) {
+      /* a bad buffer, or a wake-up with no new frame: nothing to encode */
+    } else if ( static_scene
+                and static_scene->check( frame, Timer::timestamp_ns() )
+                      == StaticSceneDetector::Verdict::Unchanged ) {
+      skip();
+    } else if ( overload and not overload->admit() ) {
+      /* skipped, to keep to the frame rate the encoder can manage */
+    } else if ( frame.is_420() or config.chroma_422 or simulcast ) {
+      /* the encoder can take the frame as it is: no conversion pass (simulcast layers convert their own) */
+      encode( frame );
+    } else {
+      const uint64_t convert_start = Timer::timestamp_ns();
+      const FramePlanes converted = converter.convert( frame, frame420 );
+      if ( static_scene ) {
+        static_scene->record_conversion( Timer::timestamp_ns() - convert_start );
+      }
+      encode( converted );
+    }
+    source->release_frame();
   } );
 
   while ( loop->wait_next_event( stats.wait_time_ms() ) != EventLoop::Result::Exit ) {}
 }
 
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [--unpaced] [--encode-yuyv] [--convert-threads N] [--encoder-threads N]\n"
+       << "       [--capture-thread] [--encode-thread] [--adaptive-fps] [--skip-static]\n"
+       << "       [--tiles N] [--simulcast] [--bitrate KBPS] [--intra-refresh] source\n";
+  cerr << "   source: V4L2 device, \"synthetic\", or a .y4m, .yuyv or .i420 file\n";
+  cerr << "   --unpaced: replay synthetic/file frames as fast as they can be encoded\n";
+  cerr << "   --encode-yuyv: encode YUYV frames as 4:2:2 without converting them to 4:2:0\n";
+  cerr << "   --convert-threads N: split YUYV => 4:2:0 conversion across N threads (default 1)\n";
+  cerr << "   --encoder-threads N: x264 threads (default: picked from the number of cores)\n";
+  cerr << "   --capture-thread: dequeue camera frames on a dedicated thread, handing over only the newest\n";
+  cerr << "   --encode-thread: encode on a dedicated thread (if it falls behind, newer frames replace older)\n";
+  cerr << "   --adaptive-fps: lower the frame rate while encoding takes longer than the frame interval\n";
+  cerr << "   --skip-static: skip converting and encoding frames that haven't changed (at least one a second)\n";
+  cerr << "   --tiles N: split frames into N side-by-side tiles, each encoded on its own (in parallel)\n";
+  cerr << "   --simulcast: encode full, half and quarter size layers (at 4000, 1200 and 400 kbps) in parallel\n";
+  cerr << "   --bitrate KBPS: constant quality capped at KBPS by the VBV (default: constant QP)\n";
+  cerr << "   --intra-refresh: refresh with a rolling column of intra blocks instead of periodic IDRs\n";
+}
+
 int main( int argc, char* argv[] )
 {
   try {
@@ -45,14 +247,47 @@ int main( int argc, char* argv[] )
 
     auto args = span( argv, argc );
 
-    if ( args.size() != 2 ) {
-      cerr << "Usage: " << args.front() << " device\n";
-      return EXIT_FAILURE;
+    Options options;
+    for ( size_t i = 1; i < args.size(); i++ ) {
+      const string_view arg = args[i];
+      if ( arg == "--unpaced" ) {
+        options.paced = false;
+      } else if ( arg == "--encode-yuyv" ) {
+        options.encode_yuyv = true;
+      } else if ( arg == "--intra-refresh" ) {
+        options.intra_refresh = true;
+      } else if ( arg == "--adaptive-fps" ) {
+        options.adaptive_fps = true;
+      } else if ( arg == "--skip-static" ) {
+        options.skip_static = true;
+      } else if ( arg == "--encode-thread" ) {
+        options.encode_thread = true;
+      } else if ( arg == "--capture-thread" ) {
+        options.capture_thread = true;
+      } else if ( arg == "--bitrate" and i + 1 < args.size() ) {
+        options.bitrate_kbps = stoul( args[++i] );
+      } else if ( arg == "--convert-threads" and i + 1 < args.size() ) {
+        options.convert_threads = stoul( args[++i] );
+      } else if ( arg == "--simulcast" ) {
+        options.simulcast = true;
+      } else if ( arg == "--tiles" and i + 1 < args.size() ) {
+        options.tiles = stoul( args[++i] );
+      } else if ( arg == "--encoder-threads" and i + 1 < args.size() ) {
+        options.encoder_threads = stoul( args[++i] );
+      } else if ( arg.starts_with( "--" ) or not options.source_name.empty() ) {
+        usage( args.front() );
+        return EXIT_FAILURE;
+      } else {
+        options.source_name = arg;
+      }
     }
 
-    const string device_name { args[1] };
+    if ( options.source_name.empty() ) {
+      usage( args.front() );
+      return EXIT_FAILURE;
+    }
 
-    camera_demo( device_name );
+    capture_demo( options );
   } catch ( const exception& e ) {
     cerr << "Died on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what() << "\n";
     return EXIT_FAILURE;
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+
+#include "congestion_control.hh"
+#include "ewma.hh"
+#include "timer.hh"
+
+using namespace std;
+
+static constexpr float SMOOTHED_RTT_ALPHA = 0.1;
+static constexpr unsigned int LOSS_CHECK_PACKETS = 20;
+
+void DelayGradientController::WindowedFilter::update( const uint64_t sample, const uint64_t now )
+{
+  const uint64_t bin = now / bin_ns;
+  if ( bin != current_bin ) {
+    /* forget the bins that have gone by since the last sample */
+    for ( uint64_t i = current_bin + 1; i <= bin and i <= current_bin + FILTER_BINS; i++ ) {
+      bins[i % FILTER_BINS].reset();
+    }
+    current_bin = bin;
+  }
+
+  auto& best_in_bin = bins[bin % FILTER_BINS];
+  if ( not best_in_bin.has_value() or ( greater ? sample > best_in_bin.value() : sample < best_in_bin.value() ) ) {
+    best_in_bin = sample;
+  }
+}
+
+optional<uint64_t> DelayGradientController::WindowedFilter::best() const
+{
+  optional<uint64_t> ret;
+  for ( const auto& bin : bins ) {
+    if ( bin.has_value() and ( not ret.has_value() or ( greater ? *bin > *ret : *bin < *ret ) ) ) {
+      ret = bin;
+    }
+  }
+  return ret;
+}
+
+DelayGradientController::DelayGradientController() : DelayGradientController( Config {} ) {}
+
+DelayGradientController::DelayGradientController( const Config& config )
+  : config_( config ), target_bps_( 1000.0 * clamp( config.initial_kbps, config.min_kbps, config.max_kbps ) )
+{
+  if ( config_.min_kbps == 0 or config_.min_kbps > config_.max_kbps ) {
+    throw runtime_error( "DelayGradientController: invalid bitrate range" );
+  }
+
+  if ( config_.decrease_factor <= 0 or config_.decrease_factor >= 1 or config_.pacing_gain < 1 ) {
+    throw runtime_error( "DelayGradientController: invalid gains" );
+  }
+
+  pacing_rate_bps_ = config_.pacing_gain * target_bps_;
+}
+
+void DelayGradientController::on_packet_sent( const uint32_t sequence_number,
+                                              const uint32_t,
+                                              const uint64_t now )
+{
+  if ( not delivered_timestamp_ ) {
+    delivered_timestamp_ = first_sent_timestamp_ = now;
+  }
+
+  sent_[sequence_number % SENT_RECORDS]
+    = { sequence_number, delivered_bytes_, delivered_timestamp_, first_sent_timestamp_ };
+}
+
+void DelayGradientController::on_packet_acked( const uint32_t sequence_number,
+                                               const uint32_t bytes,
+                                               const uint64_t sent_timestamp,
+                                               const uint64_t now )
+{
+  delivered_bytes_ += bytes;
+  delivered_timestamp_ = now;
+  acked_since_loss_check_++;
+
+  /* a delivery-rate sample: over the longer of the send and ack intervals, so bunched ACKs don't inflate it */
+  const SentRecord& record = sent_[sequence_number % SENT_RECORDS];
+  if ( record.sequence_number == sequence_number and sent_timestamp >= record.first_sent_timestamp ) {
+    first_sent_timestamp_ = sent_timestamp;
+    const uint64_t interval
+      = max( sent_timestamp - record.first_sent_timestamp, now - record.delivered_timestamp );
+    if ( interval > 0 ) {
+      delivery_rate_.update( 8 * BILLION * ( delivered_bytes_ - record.delivered_bytes ) / interval, now );
+    }
+  }
+
+  if ( now > sent_timestamp ) {
+    update_trend( now - sent_timestamp, now );
+  }
+
+  update_rate( now );
+}
+
+void DelayGradientController::on_packet_lost( const uint32_t, const uint32_t, const uint64_t now )
+{
+  lost_since_loss_check_++;
+  update_rate( now );
+}
+
+void DelayGradientController::update_trend( const uint64_t rtt_ns, const uint64_t now )
+{
+  min_rtt_.update( rtt_ns, now );
+
+  if ( not first_sample_timestamp_ ) {
+    first_sample_timestamp_ = now;
+    smoothed_rtt_ns_ = rtt_ns;
+  } else {
+    ewma_update( smoothed_rtt_ns_, double( rtt_ns ), SMOOTHED_RTT_ALPHA );
+  }
+
+  trend_[trend_count_++ % TREND_SAMPLES] = { double( now - first_sample_timestamp_ ), smoothed_rtt_ns_ };
+  if ( trend_count_ < TREND_SAMPLES ) {
+    return;
+  }
+
+  /* least-squares slope of the smoothed RTT against time */
+  double mean_t = 0, mean_rtt = 0;
+  for ( const auto& [t, rtt] : trend_ ) {
+    mean_t += t / TREND_SAMPLES;
+    mean_rtt += rtt / TREND_SAMPLES;
+  }
+
+  double covariance = 0, variance = 0;
+  for ( const auto& [t, rtt] : trend_ ) {
+    covariance += ( t - mean_t ) * ( rtt - mean_rtt );
+    variance += ( t - mean_t ) * ( t - mean_t );
+  }
+
+  slope_ = variance > 0 ? covariance / variance : 0;
+}
+
+void DelayGradientController::decrease_to( const double bps, const uint64_t now )
+{
+  target_bps_ = min( target_bps_, bps );
+  last_decrease_ = now;
+}
+
+void DelayGradientController::update_rate( const uint64_t now )
+{
+  const double elapsed_s = last_update_.has_value() ? min( 1.0, ( now - last_update_.value() ) / BILLION ) : 0;
+  last_update_ = now;
+
+  const optional<uint64_t> delivery_rate = delivery_rate_.best();
+  const double queueing_delay_ns = smoothed_rtt_ns_ - min_rtt_.best().value_or( smoothed_rtt_ns_ );
+
+  /* give the last decrease an RTT to take effect */
+  const bool may_decrease
+    = not last_decrease_.has_value() or now >= last_decrease_.value() + uint64_t( smoothed_rtt_ns_ );
+
+  if ( acked_since_loss_check_ + lost_since_loss_check_ >= LOSS_CHECK_PACKETS ) {
+    const double loss_rate
+      = double( lost_since_loss_check_ ) / ( acked_since_loss_check_ + lost_since_loss_check_ );
+    acked_since_loss_check_ = lost_since_loss_check_ = 0;
+    if ( loss_rate > config_.loss_threshold and may_decrease ) {
+      decrease_to( target_bps_ * ( 1 - loss_rate / 2 ), now );
+      loss_decreases_++;
+    }
+  }
+
+  const bool overuse
+    = ( trend_count_ >= TREND_SAMPLES and slope_ > config_.overuse_slope
+        and queueing_delay_ns > config_.min_queueing_delay_ns )
+      or queueing_delay_ns > config_.max_queueing_delay_ns;
+
+  if ( overuse ) {
+    if ( may_decrease ) {
+      decrease_to( config_.decrease_factor * delivery_rate.value_or( target_bps_ ), now );
+      decreases_++;
+    }
+  } else if ( slope_ >= -config_.overuse_slope ) {
+    /* not while a queue is draining: hold until it has */
+    double next = target_bps_ * pow( 1 + config_.increase_per_second, elapsed_s );
+    if ( delivery_rate.has_value() ) {
+      next = min( next, max( target_bps_, double( config_.max_rate_over_delivered * delivery_rate.value() ) ) );
+    }
+    target_bps_ = next;
+  }
+
+  target_bps_ = clamp( target_bps_, 1000.0 * config_.min_kbps, 1000.0 * config_.max_kbps );
+  pacing_rate_bps_ = config_.pacing_gain * target_bps_;
+}
+
+uint64_t DelayGradientController::congestion_window() const
+{
+  const optional<uint64_t> min_rtt = min_rtt_.best();
+  if ( not min_rtt.has_value() ) {
+    return max( config_.min_window_bytes, config_.initial_window_bytes );
+  }
+
+  const double rate_bps = max( target_bps_, double( delivery_rate_.best().value_or( 0 ) ) );
+  const uint64_t bdp_bytes = rate_bps * min_rtt.value() / BILLION / 8;
+  return max( config_.min_window_bytes, uint64_t( config_.window_gain * bdp_bytes ) );
+}
+
+void DelayGradientController::summary( ostream& out ) const
+{
+  out << "Congestion control: target=" << static_cast<unsigned int>( target_bps_ / 1000 ) << " kbps";
+  out << " delivered=" << delivery_rate_.best().value_or( 0 ) / 1000 << " kbps";
+  out << " window=" << congestion_window() << " bytes";
+  out << " min RTT=";
+  Timer::pp_ns( out, min_rtt_.best().value_or( 0 ) );
+  out << " queueing delay=";
+  Timer::pp_ns( out, max( 0.0, smoothed_rtt_ns_ - min_rtt_.best().value_or( smoothed_rtt_ns_ ) ) );
+  out << " slope=" << fixed << setprecision( 3 ) << slope_;
+  out << " decreases (delay/loss)=" << decreases_ << "/" << loss_decreases_ << "\n";
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+#include "summarize.hh"
+
+/* decides how fast NetworkSender may send, from what becomes of the packets it sent: a congestion window
+   (bytes allowed in flight) and a pacing rate, plus the rate the encoder should aim for */
+class CongestionController : public Summarizable
+{
+public:
+  virtual void on_packet_sent( const uint32_t sequence_number, const uint32_t bytes, const uint64_t now ) = 0;
+  virtual void on_packet_acked( const uint32_t sequence_number,
+                                const uint32_t bytes,
+                                const uint64_t sent_timestamp,
+                                const uint64_t now )
+    = 0;
+  virtual void on_packet_lost( const uint32_t sequence_number, const uint32_t bytes, const uint64_t now ) = 0;
+
+  virtual uint64_t congestion_window() const = 0; /* bytes */
+  virtual uint64_t pacing_rate_bps() const = 0;
+  virtual uint64_t target_rate_bps() const = 0; /* for the encoder, leaving room for retransmissions */
+};
+
+/* a delay-gradient controller, after GCC and BBR. The trend of the RTT samples (a least-squares slope over
+   the last few) tells whether a queue is building; if it is, and the RTT has grown by more than noise
+   above the smallest seen, the target drops to a fraction of the delivery rate measured (once per RTT).
+   Otherwise the target grows multiplicatively, but no further than the path has shown it can deliver
+   (video is mostly application-limited). Heavy loss backs off too. The window is a multiple of the
+   bandwidth-delay product (delivery rate and smallest RTT, each over a sliding window), and packets are
+   paced a bit faster than the target so that queues drain. */
+class DelayGradientController : public CongestionController
+{
+public:
+  struct Config
+  {
+    unsigned int min_kbps { 300 };
+    unsigned int max_kbps { 20'000 };
+    unsigned int initial_kbps { 2000 };
+
+    uint64_t min_window_bytes { 8'000 };      /* about seven full packets */
+    uint64_t initial_window_bytes { 32'000 }; /* until there is an RTT sample */
+    float window_gain { 2 };                  /* times the bandwidth-delay product */
+    float pacing_gain { 1.25 };               /* times the target */
+
+    float overuse_slope { 0.02 };                   /* RTT growth (ns) per ns: a queue is building */
+    uint64_t min_queueing_delay_ns { 5'000'000 };   /* ignore slopes while the RTT is within this of its min */
+    uint64_t max_queueing_delay_ns { 100'000'000 }; /* a standing queue this long is overuse, slope or not */
+    float decrease_factor { 0.85 };                 /* of the delivery rate, on overuse */
+    float increase_per_second { 0.08 };             /* while nothing is wrong */
+    float max_rate_over_delivered { 1.5 };          /* the target stays below this times the delivery rate */
+    float loss_threshold { 0.1 };                   /* back off by half the loss rate above this */
+  };
+
+private:
+  static constexpr unsigned int TREND_SAMPLES = 20;
+  static constexpr unsigned int FILTER_BINS = 10;
+  static constexpr unsigned int SENT_RECORDS = 512; /* as many as NetworkSender keeps in flight */
+
+  /* the best of the samples of the last few intervals: a max, or (with `greater` false) a min */
+  struct WindowedFilter
+  {
+    uint64_t bin_ns;
+    bool greater;
+    std::array<std::optional<uint64_t>, FILTER_BINS> bins {};
+    uint64_t current_bin {};
+
+    void update( const uint64_t sample, const uint64_t now );
+    std::optional<uint64_t> best() const;
+  };
+
+  /* the delivery state when a packet was sent, for a rate sample when it is acked */
+  struct SentRecord
+  {
+    uint32_t sequence_number;
+    uint64_t delivered_bytes, delivered_timestamp;
+    uint64_t first_sent_timestamp; /* of the last packet delivered by then */
+  };
+
+  Config config_;
+
+  double target_bps_;
+  uint64_t pacing_rate_bps_ {};
+
+  uint64_t delivered_bytes_ {}, delivered_timestamp_ {}, first_sent_timestamp_ {};
+  std::array<SentRecord, SENT_RECORDS> sent_ {};
+
+  WindowedFilter delivery_rate_ { 100'000'000, true }; /* bps, over the last second */
+  WindowedFilter min_rtt_ { 1'000'000'000, false };    /* ns, over the last ten seconds */
+
+  /* (time, smoothed RTT) samples for the delay gradient */
+  std::array<std::pair<double, double>, TREND_SAMPLES> trend_ {};
+  unsigned int trend_count_ {};
+  double smoothed_rtt_ns_ {}, slope_ {};
+  uint64_t first_sample_timestamp_ {};
+
+  std::optional<uint64_t> last_update_ {}, last_decrease_ {};
+  unsigned int acked_since_loss_check_ {}, lost_since_loss_check_ {};
+
+  unsigned int decreases_ {}, loss_decreases_ {};
+
+  void update_trend( const uint64_t rtt_ns, const uint64_t now );
+  void update_rate( const uint64_t now );
+  void decrease_to( const double bps, const uint64_t now );
+
+public:
+  DelayGradientController();
+  explicit DelayGradientController( const Config& config );
+
+  void on_packet_sent( const uint32_t sequence_number, const uint32_t bytes, const uint64_t now ) override;
+  void on_packet_acked( const uint32_t sequence_number,
+                        const uint32_t bytes,
+                        const uint64_t sent_timestamp,
+                        const uint64_t now ) override;
+  void on_packet_lost( const uint32_t sequence_number, const uint32_t bytes, const uint64_t now ) override;
+
+  uint64_t congestion_window() const override;
+  uint64_t pacing_rate_bps() const override { return pacing_rate_bps_; }
+  uint64_t target_rate_bps() const override { return target_bps_; }
+
+  void summary( std::ostream& out ) const override;
+};
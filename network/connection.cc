@@ -23,6 +23,17 @@ NetworkConnection<FrameType, SourceType>::NetworkConnection( const char node_id,
   : node_id_( node_id ), peer_id_( peer_id ), crypto_( move( crypto ) ), auto_home_( true ), destination_()
 {}
 
+template<class FrameType, class SourceType>
+void NetworkConnection<FrameType, SourceType>::set_mtu( const unsigned int mtu )
+{
+  if ( mtu < min_mtu ) {
+    throw runtime_error( "MTU " + to_string( mtu ) + " is too small (minimum " + to_string( min_mtu ) + ")" );
+  }
+
+  mtu_ = mtu;
+  sender_.set_max_frames_length( max_frames_length<FrameType>( mtu_ ) );
+}
+
 template<class FrameType, class SourceType>
 void NetworkConnection<FrameType, SourceType>::send_packet( UDPSocket& socket )
 {
@@ -35,8 +46,27 @@ void NetworkConnection<FrameType, SourceType>::send_packet( UDPSocket& socket )
   sender_.set_sender_section( pack.sender_section );
   receiver_.set_receiver_section( pack.receiver_section );
 
+  /* ask the peer to recover from lost frames (unless an update is already waiting its turn): at once for a new
+     loss, then again every RTT while the request or the recovery may have been lost on the way */
+  const uint64_t now = Timer::timestamp_ns();
+  const uint64_t resend_interval = max( min_recovery_request_interval, uint64_t( sender_.stats().smoothed_rtt ) );
+  if ( const auto recovery_request = receiver_.recovery_request();
+       recovery_request.has_value() and not pending_outbound_unreliable_data_.has_value()
+       and ( receiver_.recovery_request_due() or not last_recovery_request_sent_.has_value()
+             or now >= last_recovery_request_sent_.value() + resend_interval ) ) {
+    NetString request;
+    Serializer s { request.mutable_buffer() };
+    s.object( recovery_request.value() );
+    request.resize( s.bytes_written() );
+    pending_outbound_unreliable_data_.emplace( request );
+    receiver_.recovery_request_sent();
+    last_recovery_request_sent_ = now;
+  }
+
   /* do we have room for an unreliable update? */
-  if ( pending_outbound_unreliable_data_.has_value() and ( pack.serialized_length() < 1200 ) ) {
+  if ( pending_outbound_unreliable_data_.has_value()
+       and pack.serialized_length() + pending_outbound_unreliable_data_->length()
+             <= max_plaintext_length( mtu_ ) ) {
     pack.unreliable_data_ = pending_outbound_unreliable_data_.value();
     pending_outbound_unreliable_data_.reset();
   }
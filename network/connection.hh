@@ -25,6 +25,8 @@ class NetworkConnection : public Summarizable
   std::optional<Address> destination_;
   std::optional<uint32_t> last_biggest_seqno_received_ {};
 
+  unsigned int mtu_ { default_mtu };
+
   struct Statistics
   {
     unsigned int decryption_failures {}, invalid {};
@@ -33,6 +35,11 @@ class NetworkConnection : public Summarizable
   std::optional<NetString> pending_outbound_unreliable_data_ {};
   std::optional<NetString> inbound_unreliable_data_ {};
 
+  /* a recovery request goes out once per RTT (or this often, without one to go by) until the receiver has a
+     recovery point */
+  static constexpr uint64_t min_recovery_request_interval = 100'000'000;
+  std::optional<uint64_t> last_recovery_request_sent_ {};
+
 public:
   NetworkConnection( const char node_id, const char peer_id, CryptoSession&& crypto );
   NetworkConnection( const char node_id, const char peer_id, CryptoSession&& crypto, const Address& destination );
@@ -41,6 +48,10 @@ public:
   const Address& destination() const { return destination_.value(); }
 
   void push_frame( SourceType& source ) { sender_.push_frame( source ); }
+
+  /* fit each packet in one datagram on a path of this MTU; frames pushed must fit too (max_chunk_size()) */
+  void set_mtu( const unsigned int mtu );
+  unsigned int mtu() const { return mtu_; }
   void summary( std::ostream& out ) const override;
 
   void send_packet( UDPSocket& socket );
@@ -56,6 +67,22 @@ public:
   uint8_t peer_id() const { return peer_id_; }
 
   const typename NetworkSender<FrameType>::Statistics& sender_stats() const { return sender_.stats(); }
+
+  void set_congestion_controller( std::unique_ptr<CongestionController> controller )
+  {
+    sender_.set_congestion_controller( std::move( controller ) );
+  }
+  const CongestionController* congestion_controller() const { return sender_.congestion_controller(); }
+  bool ready_to_send( const uint64_t now ) const { return sender_.ready_to_send( now ); }
+
+  /* see NetworkSender::set_coalescing */
+  void set_coalescing( const std::optional<uint64_t> deadline_ns ) { sender_.set_coalescing( deadline_ns ); }
+  bool coalescing() const { return sender_.coalescing(); }
+  bool has_room_for( const uint32_t frame_length ) const { return sender_.has_room_for( frame_length ); }
+  bool packet_full() const { return sender_.packet_full(); }
+  bool coalesced_packet_due( const uint64_t now ) const { return sender_.coalesced_packet_due( now ); }
+  uint64_t coalescing_wait_ms( const uint64_t now ) const { return sender_.coalescing_wait_ms( now ); }
+  uint64_t send_wait_time_ms( const uint64_t now ) const { return sender_.wait_time_ms( now ); }
   const typename NetworkReceiver<FrameType>::Statistics& receiver_stats() const { return receiver_.stats(); }
 
   bool has_inbound_unreliable_data() const { return inbound_unreliable_data_.has_value(); }
@@ -5,7 +5,7 @@ using namespace std;
 
 uint16_t VideoChunk::serialized_length() const
 {
-  return sizeof( frame_index ) + sizeof( nal_index ) + data.serialized_length();
+  return sizeof( frame_index ) + sizeof( nal_index ) + sizeof( stream_id ) + data.serialized_length();
 }
 
 void VideoChunk::serialize( Serializer& s ) const
@@ -14,6 +14,7 @@ void VideoChunk::serialize( Serializer& s ) const
 
   s.integer( first_word );
   s.integer( nal_index );
+  s.integer( uint8_t( ( recovery_point << 7 ) | ( stream_id & 0x7F ) ) );
   s.object( data );
 }
 
@@ -25,6 +26,12 @@ void VideoChunk::parse( Parser& p )
   end_of_nal = first_word & 0x8000'0000;
 
   p.integer( nal_index );
+  p.integer( stream_id );
+  recovery_point = stream_id & 0x80;
+  stream_id &= 0x7F;
+  if ( stream_id >= max_streams ) {
+    p.set_error();
+  }
 
   p.object( data );
 }
@@ -88,3 +95,18 @@ void KeyMessage::parse( Parser& p )
   p.object( id );
   p.object( key_pair );
 }
+
+void RecoveryRequest::serialize( Serializer& s ) const
+{
+  s.object( id );
+  s.object( last_good_nal_indices );
+}
+
+void RecoveryRequest::parse( Parser& p )
+{
+  p.object( id );
+  p.object( last_good_nal_indices );
+  if ( id != recovery_id ) {
+    p.set_error();
+  }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <optional>
 
@@ -13,15 +14,28 @@ struct VideoChunk
   bool end_of_nal {};
 
   uint32_t nal_index {};
+  uint8_t stream_id {}; /* which stream (e.g. tile) the NAL is from; each numbers its NALs from 0 */
 
-  using Buffer = StackBuffer<0, uint16_t, 512>;
+  /* the NAL starts an IDR or recovery frame: it needs nothing of its stream's before it that could be lost */
+  bool recovery_point {};
+
+  /* chunks are cut to fit the path MTU (max_chunk_size()), up to a packet's worth */
+  using Buffer = StackBuffer<0, uint16_t, 1280>;
   Buffer data {};
 
+  /* sender-side latency tracing (not serialized): when the frame was captured, and when encoded */
+  uint64_t capture_timestamp {}, encoded_timestamp {};
+
   uint16_t serialized_length() const;
   void serialize( Serializer& s ) const;
   void parse( Parser& p );
 
-  static constexpr uint8_t frames_per_packet = 2;
+  /* serialized length of all but the data */
+  static constexpr uint16_t header_length
+    = sizeof( frame_index ) + sizeof( nal_index ) + sizeof( stream_id ) + sizeof( uint16_t );
+
+  static constexpr uint8_t frames_per_packet = 8; /* a full chunk fills a packet alone; small ones can share */
+  static constexpr uint8_t max_streams = 8;
 };
 
 template<typename T>
@@ -88,8 +102,8 @@ struct NetArray
   std::span<const T> as_span_view() const { return std::span<const T> { elements.data(), length }; }
   operator std::span<const T>() const { return as_span_view(); }
 
-  const T* begin() const { return as_span_view().begin(); }
-  const T* end() const { return as_span_view().end(); }
+  const T* begin() const { return elements.data(); }
+  const T* end() const { return elements.data() + length; }
 
   void push_back( const T& element )
   {
@@ -142,10 +156,64 @@ struct Packet
   void serialize( Serializer& s ) const;
   void parse( Parser& p );
 
+  /* at most, all but the frames: sequence number, next frame needed, a full list of SACKs, and room for a
+     little unreliable data (a RecoveryRequest takes 35 bytes) */
+  static constexpr uint16_t unreliable_data_reserve = 48;
+  static constexpr uint16_t max_overhead = sizeof( SenderSection::sequence_number )
+                                           + sizeof( ReceiverSection::next_frame_needed )
+                                           + 1 + 4 * decltype( ReceiverSection::packets_received )::capacity
+                                           + 1 + unreliable_data_reserve;
+
   Packet() {}
   Packet( Parser& p ) { parse( p ); }
 };
 
+/* sizing packets to the path MTU: a packet goes out as one UDP datagram (with IPv4 and UDP headers) of
+   ciphertext, which is the plaintext plus tag, nonce and associated data */
+static constexpr unsigned int default_mtu = 1500;
+static constexpr unsigned int min_mtu = 576; /* every IPv4 path carries this much */
+static constexpr unsigned int ip_udp_header_length = 20 + 8;
+
+constexpr uint16_t max_plaintext_length( const unsigned int mtu )
+{
+  constexpr unsigned int ciphertext_overhead = Ciphertext::capacity() - Plaintext::capacity();
+  return std::min( mtu - ip_udp_header_length - ciphertext_overhead, unsigned( Plaintext::capacity() ) );
+}
+
+/* the room for frames in a packet (their NetArray included) */
+template<class FrameType>
+constexpr uint16_t max_frames_length( const unsigned int mtu )
+{
+  return max_plaintext_length( mtu ) - Packet<FrameType>::max_overhead;
+}
+
+/* the largest chunk of video data that fits, alone, in a packet */
+constexpr uint16_t max_chunk_size( const unsigned int mtu )
+{
+  return max_frames_length<VideoChunk>( mtu ) - 1 - VideoChunk::header_length;
+}
+
+static_assert( max_chunk_size( min_mtu ) > 0 );
+static_assert( max_chunk_size( 65536 ) <= VideoChunk::Buffer::capacity(), "Buffer can't take a packet's worth" );
+
+/* receiver => sender (in Packet::unreliable_data_): frames were lost for good, so please send something
+   decodable from what did arrive */
+struct RecoveryRequest
+{
+  static constexpr uint8_t recovery_id = 1;
+  static constexpr uint32_t no_nal = -1;
+
+  NetInteger<uint8_t> id { recovery_id };
+
+  /* per stream: the last NAL received in full with all of the stream's before it (back to a recovery point),
+     or no_nal */
+  NetArray<NetInteger<uint32_t>, VideoChunk::max_streams> last_good_nal_indices {};
+
+  uint32_t serialized_length() const { return id.serialized_length() + last_good_nal_indices.serialized_length(); }
+  void serialize( Serializer& s ) const;
+  void parse( Parser& p );
+};
+
 struct KeyMessage
 {
   static constexpr char keyreq_id = uint8_t( 254 );
@@ -1,6 +1,8 @@
 #include "receiver.hh"
 #include "timer.hh"
 
+#include <algorithm>
+
 using namespace std;
 
 template<class FrameType>
@@ -34,6 +36,7 @@ void NetworkReceiver<FrameType>::receive_sender_section(
     }
 
     dest = frame;
+    num_streams_ = max( num_streams_, uint8_t( frame.stream_id + 1 ) );
     stats_.last_new_frame_received = now;
   }
 
@@ -44,7 +47,7 @@ void NetworkReceiver<FrameType>::receive_sender_section(
       recent_packets_.pop( 1 );
     }
 
-    recent_packets_.writable_region().at( 0 ) = sender_section.to_record();
+    recent_packets_.writable_region()[0] = sender_section.to_record();
     recent_packets_.push( 1 );
   }
 }
@@ -54,7 +57,18 @@ void NetworkReceiver<FrameType>::discard_frames( const unsigned int num )
 {
   frames_.pop( num );
   stats_.dropped += num;
-  next_frame_needed_ = frames_.range_begin();
+
+  /* gave up on frames that never arrived? */
+  if ( frames_.range_begin() > next_frame_needed_ ) {
+    next_frame_needed_ = frames_.range_begin();
+
+    /* the lost chunks could have been from any stream */
+    nal_broken_.fill( true );
+
+    recovery_request_due_ = true;
+    stats_.recovery_requests++;
+  }
+
   advance_next_frame_needed();
 }
 
@@ -62,10 +76,39 @@ template<class FrameType>
 void NetworkReceiver<FrameType>::advance_next_frame_needed()
 {
   while ( next_frame_needed_ < frames_.range_end() and frames_.at( next_frame_needed_ ).has_value() ) {
+    const FrameType& frame = frames_.at( next_frame_needed_ ).value();
+    if ( frame.end_of_nal ) {
+      /* good if whole, and either next after the last good one (no_nal + 1 wraps to 0) or needing nothing
+         before it: a NAL after a gap is no use until the sender recovers */
+      uint32_t& last_good = last_good_nal_index_[frame.stream_id];
+      const bool good
+        = not nal_broken_[frame.stream_id] and ( frame.nal_index == last_good + 1 or frame.recovery_point );
+      if ( good ) {
+        last_good = frame.nal_index;
+      }
+      behind_gap_[frame.stream_id] = not good;
+      nal_broken_[frame.stream_id] = false;
+    }
     next_frame_needed_++;
   }
 }
 
+template<class FrameType>
+optional<RecoveryRequest> NetworkReceiver<FrameType>::recovery_request() const
+{
+  optional<RecoveryRequest> ret;
+
+  if ( recovery_request_due_
+       or any_of( behind_gap_.begin(), behind_gap_.begin() + num_streams_, []( const bool b ) { return b; } ) ) {
+    ret.emplace();
+    for ( uint8_t i = 0; i < num_streams_; i++ ) {
+      ret->last_good_nal_indices.push_back( last_good_nal_index_[i] );
+    }
+  }
+
+  return ret;
+}
+
 template<class FrameType>
 void NetworkReceiver<FrameType>::set_receiver_section(
   typename Packet<FrameType>::ReceiverSection& receiver_section )
@@ -122,6 +165,9 @@ void NetworkReceiver<FrameType>::summary( ostream& out ) const
   if ( stats_.dropped ) {
     out << " dropped=" << stats_.dropped << "!";
   }
+  if ( stats_.recovery_requests ) {
+    out << " recovery_requests=" << stats_.recovery_requests;
+  }
 
   const uint32_t contiguous_count = next_frame_needed_ - frames_.range_begin();
   uint32_t other_count = 0;
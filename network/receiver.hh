@@ -31,6 +31,17 @@ class NetworkReceiver
 
   std::optional<uint32_t> biggest_seqno_received_ {};
 
+  /* per stream: the last NAL that arrived whole, with everything before it (back to a recovery point), whether
+     the NAL now arriving is missing its beginning, and whether NALs have arrived since that can't be used
+     (behind a gap) while waiting for a recovery point */
+  std::array<uint32_t, FrameType::max_streams> last_good_nal_index_ {};
+  std::array<bool, FrameType::max_streams> nal_broken_ {};
+  std::array<bool, FrameType::max_streams> behind_gap_ {};
+  uint8_t num_streams_ { 1 };
+
+  /* frames have been given up on, and the sender not yet told */
+  bool recovery_request_due_ {};
+
   TypedRingBuffer<typename Packet<FrameType>::Record> recent_packets_ { 512 };
 
   void discard_frames( const unsigned int num );
@@ -39,7 +50,7 @@ class NetworkReceiver
 public:
   struct Statistics
   {
-    unsigned int already_acked, redundant, dropped, popped;
+    unsigned int already_acked, redundant, dropped, popped, recovery_requests;
     std::optional<uint64_t> last_new_frame_received;
   };
 
@@ -47,6 +58,8 @@ private:
   Statistics stats_ {};
 
 public:
+  NetworkReceiver() { last_good_nal_index_.fill( RecoveryRequest::no_nal ); }
+
   void receive_sender_section( const typename Packet<FrameType>::SenderSection& sender_section );
   void set_receiver_section( typename Packet<FrameType>::ReceiverSection& receiver_section );
 
@@ -60,5 +73,11 @@ public:
 
   uint32_t biggest_seqno_received() const { return biggest_seqno_received_.value(); }
 
+  /* what to ask the sender to recover from: due once frames have been given up on, and worth repeating while
+     any stream is behind a gap (the request or its recovery may have been lost) */
+  std::optional<RecoveryRequest> recovery_request() const;
+  bool recovery_request_due() const { return recovery_request_due_; }
+  void recovery_request_sent() { recovery_request_due_ = false; }
+
   const Statistics& stats() const { return stats_; }
 };
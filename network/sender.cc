@@ -1,3 +1,5 @@
+#include <bit>
+
 #include "sender.hh"
 #include "ewma.hh"
 
@@ -7,6 +9,7 @@ template<class FrameType>
 void NetworkSender<FrameType>::summary( ostream& out ) const
 {
   out << "Sender info:";
+  const uint64_t now = Timer::timestamp_ns();
 
   out << " RTT=";
   Timer::pp_ns( out, stats_.smoothed_rtt );
@@ -15,6 +18,16 @@ void NetworkSender<FrameType>::summary( ostream& out ) const
     out << " frames_dropped=" << stats_.frames_dropped << "!";
   }
 
+  if ( stats_.packet_transmissions > 0 ) {
+    out << " frames/packet=" << fixed << setprecision( 2 )
+        << stats_.frames_sent / double( stats_.packet_transmissions );
+    out << " frame bytes/packet=" << stats_.frame_bytes_sent / stats_.packet_transmissions;
+    if ( now > stats_.first_transmission_ts ) {
+      out << " packets/s=" << fixed << setprecision( 0 )
+          << stats_.packet_transmissions * BILLION / ( now - stats_.first_transmission_ts );
+    }
+  }
+
   if ( stats_.empty_packets ) {
     out << " empty_packets=" << stats_.empty_packets;
   }
@@ -77,6 +90,208 @@ void NetworkSender<FrameType>::summary( ostream& out ) const
       << "]";
 
   out << "\n";
+
+  out << "   capture->first sent: ";
+  latency_.capture_to_first_sent.summary( out );
+  out << "\n   encoded->first sent: ";
+  latency_.encoded_to_first_sent.summary( out );
+  out << "\n   first sent->acked: ";
+  latency_.first_sent_to_acked.summary( out );
+  out << "\n";
+
+  if ( congestion_control_ ) {
+    out << "   in flight=" << bytes_in_flight_ << " bytes; ";
+    congestion_control_->summary( out );
+  }
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::set_congestion_controller( unique_ptr<CongestionController> controller )
+{
+  congestion_control_ = move( controller );
+}
+
+template<class FrameType>
+bool NetworkSender<FrameType>::has_room_for( const uint32_t frame_length ) const
+{
+  if ( 1 + frame_length > max_frames_length_ ) {
+    return false;
+  }
+
+  return plan_packet( frame_length ).unsent == unsent_frames_ + 1;
+}
+
+template<class FrameType>
+bool NetworkSender<FrameType>::packet_full() const
+{
+  /* the next packet leaves some frame not yet sent behind, or has no room for even one byte of another */
+  const PacketPlan plan = plan_packet();
+  return plan.unsent < unsent_frames_ or plan.num_frames >= FrameType::frames_per_packet
+         or plan.length + FrameType::header_length + 1 > max_frames_length_;
+}
+
+template<class FrameType>
+bool NetworkSender<FrameType>::coalesced_packet_due( const uint64_t now ) const
+{
+  return coalescing_deadline_ns_.has_value() and unsent_frames_
+         and now >= oldest_unsent_timestamp_ + coalescing_deadline_ns_.value();
+}
+
+template<class FrameType>
+uint64_t NetworkSender<FrameType>::coalescing_wait_ms( const uint64_t now ) const
+{
+  if ( not coalescing_deadline_ns_.has_value() or not unsent_frames_ ) {
+    return 60'000;
+  }
+
+  if ( coalesced_packet_due( now ) ) {
+    return 0;
+  }
+
+  return ( oldest_unsent_timestamp_ + coalescing_deadline_ns_.value() - now + 999'999 ) / 1'000'000;
+}
+
+template<class FrameType>
+uint64_t NetworkSender<FrameType>::stall_timeout() const
+{
+  return max( uint64_t( 200'000'000 ), uint64_t( 2 * stats_.smoothed_rtt ) );
+}
+
+template<class FrameType>
+bool NetworkSender<FrameType>::ready_to_send( const uint64_t now ) const
+{
+  if ( not congestion_control_ ) {
+    return true;
+  }
+
+  return bytes_in_flight_ < congestion_control_->congestion_window()
+         or now >= last_sent_timestamp_ + stall_timeout();
+}
+
+template<class FrameType>
+uint64_t NetworkSender<FrameType>::wait_time_ms( const uint64_t now ) const
+{
+  if ( ready_to_send( now ) ) {
+    return 0;
+  }
+
+  /* the window is full: an ACK will open it (or the stall timeout will pass). Rounded up, so as not to spin
+     through the last millisecond. */
+  return ( last_sent_timestamp_ + stall_timeout() - now + 999'999 ) / 1'000'000;
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::mark_sent( const uint32_t frame_index, const uint64_t now )
+{
+  auto& status = frame_status_.at( frame_index );
+  const auto& frame = frames_.at( frame_index );
+  status.in_flight = true;
+  update_needs_send( frame_index );
+
+  if ( status.first_sent_timestamp ) {
+    return;
+  }
+
+  forget_unsent( status );
+  status.first_sent_timestamp = now;
+
+  if ( frame.capture_timestamp and frame.capture_timestamp <= now ) {
+    latency_.capture_to_first_sent.record( now - frame.capture_timestamp );
+  }
+
+  if ( frame.encoded_timestamp and frame.encoded_timestamp <= now ) {
+    latency_.encoded_to_first_sent.record( now - frame.encoded_timestamp );
+  }
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::mark_acked( const uint32_t frame_index, const uint64_t now )
+{
+  auto& status = frame_status_.at( frame_index );
+  if ( status.outstanding and status.first_sent_timestamp and status.first_sent_timestamp <= now ) {
+    latency_.first_sent_to_acked.record( now - status.first_sent_timestamp );
+  }
+
+  forget_unsent( status );
+  status = { false, false, 0 };
+  update_needs_send( frame_index );
+}
+
+template<class FrameType>
+unsigned int NetworkSender<FrameType>::size_class( const uint32_t length )
+{
+  return min( size_classes - 1, unsigned( bit_width( ( max( length, 1u ) - 1 ) >> 6 ) ) );
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::update_needs_send( const uint32_t frame_index )
+{
+  needs_send_[size_class( frames_[frame_index].serialized_length() )].assign(
+    frame_index, frame_status_[frame_index].needs_send() );
+}
+
+template<class FrameType>
+typename NetworkSender<FrameType>::PacketPlan NetworkSender<FrameType>::plan_packet(
+  const optional<uint32_t> new_frame_length ) const
+{
+  PacketPlan plan;
+
+  const auto add = [&]( const uint32_t frame_index, const uint32_t length, const bool unsent ) {
+    if ( plan.length + length > max_frames_length_ ) {
+      throw runtime_error( "NetworkSender: frame too big for the packet" );
+    }
+    plan.frames[plan.num_frames++] = frame_index;
+    plan.length += length;
+    plan.unsent += unsent;
+  };
+
+  const auto add_existing = [&]( const uint32_t frame_index ) {
+    const bool unsent = not frame_status_[frame_index].first_sent_timestamp;
+    add( frame_index, frames_[frame_index].serialized_length(), unsent );
+  };
+
+  /* always send the most recent frame if it needs it */
+  uint32_t end = next_frame_index_;
+  if ( new_frame_length.has_value() ) {
+    add( next_frame_index_, new_frame_length.value(), true );
+  } else if ( next_frame_index_ > frame_status_.range_begin()
+              and frame_status_[next_frame_index_ - 1].needs_send() ) {
+    end = next_frame_index_ - 1;
+    add_existing( end );
+  }
+
+  /* then the oldest that fit: the oldest of each size class is a candidate, and a class whose candidate
+     doesn't fit is done with (the room only shrinks), so this costs a search per class and per frame taken,
+     however many frames are waiting */
+  array<optional<size_t>, size_classes> candidates;
+  for ( unsigned int c = 0; c < size_classes; c++ ) {
+    candidates[c] = needs_send_[c].find_first( frame_status_.range_begin(), end );
+  }
+
+  while ( plan.num_frames < FrameType::frames_per_packet ) {
+    optional<unsigned int> oldest;
+    for ( unsigned int c = 0; c < size_classes; c++ ) {
+      if ( not candidates[c].has_value() ) {
+        continue;
+      }
+
+      if ( plan.length + frames_[candidates[c].value()].serialized_length() > max_frames_length_ ) {
+        candidates[c].reset();
+      } else if ( not oldest.has_value() or candidates[c].value() < candidates[oldest.value()].value() ) {
+        oldest = c;
+      }
+    }
+
+    if ( not oldest.has_value() ) {
+      break;
+    }
+
+    auto& candidate = candidates[oldest.value()];
+    add_existing( candidate.value() );
+    candidate = needs_send_[oldest.value()].find_first( candidate.value() + 1, end );
+  }
+
+  return plan;
 }
 
 template<class FrameType>
@@ -88,35 +303,20 @@ void NetworkSender<FrameType>::set_sender_section( typename Packet<FrameType>::S
 
   p.sequence_number = next_sequence_number_++;
 
+  const uint64_t now = Timer::timestamp_ns();
+
   /* send some frames! */
   if ( frames_.range_begin() == next_frame_index_ ) { // nothing to send
     stats_.empty_packets++;
   } else {
-    /* always send the most recent frame if it needs it */
-    const auto& most_recent_frame = frames_.at( next_frame_index_ - 1 );
-    auto& most_recent_status = frame_status_.at( next_frame_index_ - 1 );
-    if ( most_recent_status.needs_send() ) {
-      p.frames.push_back( most_recent_frame );
-      most_recent_status.in_flight = true;
-      need_immediate_send_ = false;
+    const PacketPlan plan = plan_packet();
+    for ( uint8_t i = 0; i < plan.num_frames; i++ ) {
+      p.frames.push_back( frames_.at( plan.frames[i] ) );
+      mark_sent( plan.frames[i], now );
     }
 
-    /* now, attempt to fill up the other slots for frames in the packet */
-    span<FrameStatus> statuses
-      = frame_status_.region( frame_status_.range_begin(), next_frame_index_ - frame_status_.range_begin() );
-    const span<FrameType> frames
-      = frames_.region( frame_status_.range_begin(), next_frame_index_ - frame_status_.range_begin() );
-    for ( uint32_t i = 0; i < statuses.size(); i++ ) {
-      auto& status = statuses[i];
-
-      if ( status.needs_send() ) {
-        p.frames.push_back( frames[i] );
-        status.in_flight = true;
-
-        if ( p.frames.length >= p.frames.capacity ) {
-          break;
-        }
-      }
+    if ( plan.num_frames and plan.frames[0] == next_frame_index_ - 1 ) {
+      need_immediate_send_ = false;
     }
   }
 
@@ -127,7 +327,7 @@ void NetworkSender<FrameType>::set_sender_section( typename Packet<FrameType>::S
     const span<const PacketSentRecord> packets_to_drop
       = packets_in_flight_.region( packets_in_flight_.range_begin(), num_packets_to_drop );
     for ( const auto& pack : packets_to_drop ) {
-      assume_departed( pack, false );
+      assume_departed( pack, false, now );
     }
 
     packets_in_flight_.pop( num_packets_to_drop );
@@ -138,23 +338,43 @@ void NetworkSender<FrameType>::set_sender_section( typename Packet<FrameType>::S
   pack.record = p.to_record();
   pack.assumed_lost = false;
   pack.acked = false;
-  pack.sent_timestamp = Timer::timestamp_ns();
+  pack.sent_timestamp = now;
+  pack.frame_bytes = p.frames.serialized_length();
   stats_.packet_transmissions++;
+  stats_.frame_bytes_sent += pack.frame_bytes;
+  stats_.frames_sent += p.frames.length;
+  if ( not stats_.first_transmission_ts ) {
+    stats_.first_transmission_ts = now;
+  }
+
+  bytes_in_flight_ += pack.frame_bytes;
+  last_sent_timestamp_ = now;
+  if ( congestion_control_ ) {
+    congestion_control_->on_packet_sent( p.sequence_number, pack.frame_bytes, now );
+  }
 }
 
 template<class FrameType>
-void NetworkSender<FrameType>::assume_departed( const PacketSentRecord& pack, const bool is_loss )
+void NetworkSender<FrameType>::assume_departed( const PacketSentRecord& pack,
+                                                const bool is_loss,
+                                                const uint64_t now )
 {
   if ( pack.acked or pack.assumed_lost ) {
     return;
   }
 
+  bytes_in_flight_ -= pack.frame_bytes;
+  if ( is_loss and congestion_control_ ) {
+    congestion_control_->on_packet_lost( pack.record.sequence_number, pack.frame_bytes, now );
+  }
+
   bool frame_departed = false;
   for ( const uint32_t frame_to_mark : pack.record.frames ) {
     // frame might have been dropped or delivered already
     if ( frame_to_mark >= frame_status_.range_begin() and frame_to_mark < frame_status_.range_end()
          and frame_status_[frame_to_mark].outstanding and frame_status_[frame_to_mark].in_flight ) {
       frame_status_[frame_to_mark].in_flight = false;
+      update_needs_send( frame_to_mark );
       frame_departed = true;
     }
   }
@@ -181,16 +401,22 @@ void NetworkSender<FrameType>::receive_receiver_section(
     return;
   }
 
+  const uint64_t now = Timer::timestamp_ns();
+
   if ( receiver_section.next_frame_needed > frames_.range_begin() ) {
     const size_t num_to_pop = receiver_section.next_frame_needed - frames_.range_begin();
+
+    /* cumulatively acked */
+    for ( uint32_t i = frames_.range_begin(); i < receiver_section.next_frame_needed; i++ ) {
+      mark_acked( i, now );
+    }
+
     frames_.pop( num_to_pop );
     frame_status_.pop( num_to_pop );
   }
 
   optional<uint32_t> greatest_new_sack;
 
-  const uint64_t now = Timer::timestamp_ns();
-
   /* For each selectively ACKed packet, mark its Frames as no longer outstanding */
   for ( const uint32_t sack : receiver_section.packets_received ) {
     if ( sack >= packets_in_flight_.range_end() ) {
@@ -217,9 +443,17 @@ void NetworkSender<FrameType>::receive_receiver_section(
 
       if ( pack.assumed_lost ) {
         stats_.packet_loss_false_positives++;
+      } else {
+        bytes_in_flight_ -= pack.frame_bytes;
       }
 
       pack.acked = true;
+      stats_.packets_acked++;
+      stats_.frame_bytes_acked += pack.frame_bytes;
+
+      if ( congestion_control_ ) {
+        congestion_control_->on_packet_acked( sack, pack.frame_bytes, pack.sent_timestamp, now );
+      }
 
       const int64_t time_diff = now - pack.sent_timestamp;
       if ( time_diff <= 0 ) {
@@ -234,7 +468,7 @@ void NetworkSender<FrameType>::receive_receiver_section(
         }
 
         if ( frame_index >= frame_status_.range_begin() ) {
-          frame_status_.at( frame_index ) = { false, false };
+          mark_acked( frame_index, now );
         }
       }
     }
@@ -261,7 +495,7 @@ void NetworkSender<FrameType>::receive_receiver_section(
   for ( unsigned int seqno = start_of_range_to_assume_departed; seqno < end_of_range_to_assume_departed; seqno++ ) {
     if ( packets_in_flight_.range_begin() <= seqno and packets_in_flight_.range_end() > seqno
          and not packets_in_flight_[seqno].acked ) {
-      assume_departed( packets_in_flight_[seqno], true );
+      assume_departed( packets_in_flight_[seqno], true, now );
       packets_in_flight_[seqno].assumed_lost = true;
     }
   }
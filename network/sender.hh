@@ -1,8 +1,13 @@
 #pragma once
 
+#include <array>
+#include <memory>
 #include <ostream>
 
+#include "congestion_control.hh"
 #include "formats.hh"
+#include "histogram.hh"
+#include "ring_bitset.hh"
 #include "timer.hh"
 #include "typed_ring_buffer.hh"
 
@@ -13,14 +18,37 @@ class NetworkSender
   {
     bool outstanding : 1;
     bool in_flight : 1;
+    uint64_t first_sent_timestamp; /* 0 until first transmitted */
 
     bool needs_send() const { return outstanding and not in_flight; }
   };
 
-  EndlessBuffer<FrameType> frames_ { 8192 }; // 20.48 seconds
-  EndlessBuffer<FrameStatus> frame_status_ { 8192 };
+  constexpr static size_t frame_window = 8192; // 20.48 seconds
+
+  EndlessBuffer<FrameType> frames_ { frame_window };
+  EndlessBuffer<FrameStatus> frame_status_ { frame_window };
   uint32_t next_frame_index_ {};
 
+  /* the frames whose status needs_send(), by size class (serialized length up to 64 << class, the last
+     class taking the rest), so filling a packet looks only at frames that can fit */
+  constexpr static unsigned int size_classes = 6;
+  std::array<RingBitset<frame_window>, size_classes> needs_send_ {};
+
+  static unsigned int size_class( const uint32_t length );
+  void update_needs_send( const uint32_t frame_index );
+
+  /* the frames the next packet will carry (see set_sender_section), or would if a frame of
+     `new_frame_length` were pushed first (it would be the most recent, with index next_frame_index_) */
+  struct PacketPlan
+  {
+    std::array<uint32_t, FrameType::frames_per_packet> frames {};
+    uint8_t num_frames {};
+    uint32_t length { 1 }; /* serialized, with the frames' NetArray length byte */
+    unsigned int unsent {}; /* of the frames, those never sent before */
+  };
+
+  PacketPlan plan_packet( const std::optional<uint32_t> new_frame_length = {} ) const;
+
   constexpr static uint8_t reorder_window = 2; /* 2 packets, about 5 ms */
   std::optional<uint32_t> greatest_sack_ {};
   uint32_t departure_adjudicated_until_seqno() const;
@@ -29,6 +57,7 @@ class NetworkSender
   {
     typename Packet<FrameType>::Record record;
     uint64_t sent_timestamp;
+    uint32_t frame_bytes; /* serialized size of the frames it carried */
     bool acked : 1;
     bool assumed_lost : 1;
   };
@@ -38,7 +67,32 @@ class NetworkSender
 
   bool need_immediate_send_ {};
 
-  void assume_departed( const PacketSentRecord& pack, const bool is_loss );
+  uint16_t max_frames_length_ { max_frames_length<FrameType>( default_mtu ) }; /* per packet */
+
+  /* coalescing: frames pushed wait, up to the deadline, to share a packet with the ones after them */
+  std::optional<uint64_t> coalescing_deadline_ns_ {};
+  unsigned int unsent_frames_ {}; /* pushed but never sent */
+  uint64_t oldest_unsent_timestamp_ {};
+
+  /* for each frame leaving the window, or sent for the first time */
+  void forget_unsent( const FrameStatus& status )
+  {
+    if ( status.outstanding and not status.first_sent_timestamp ) {
+      unsent_frames_--;
+    }
+  }
+
+  /* optional: without one, packets go out whenever the source is ready */
+  std::unique_ptr<CongestionController> congestion_control_ {};
+  uint64_t bytes_in_flight_ {}; /* of frames, in packets neither acked nor given up on */
+  uint64_t last_sent_timestamp_ {};
+
+  uint64_t stall_timeout() const;
+
+  void assume_departed( const PacketSentRecord& pack, const bool is_loss, const uint64_t now );
+
+  void mark_sent( const uint32_t frame_index, const uint64_t now );
+  void mark_acked( const uint32_t frame_index, const uint64_t now );
 
 public:
   struct Statistics
@@ -51,13 +105,26 @@ public:
 
     float smoothed_rtt {};
 
+    unsigned int packets_acked {};
+    uint64_t frame_bytes_acked {}; /* delivery-rate estimates count these */
+
+    uint64_t frame_bytes_sent {}, frames_sent {}; /* per packet, to see how full packets are */
+    uint64_t first_transmission_ts {};
+
     unsigned int packet_losses() const { return packet_losses_detected - packet_loss_false_positives; }
 
     uint64_t last_good_ack_ts = Timer::timestamp_ns();
   };
 
+  /* per-frame latency of each stage (for VideoChunks, a frame is one chunk) */
+  struct LatencyStatistics
+  {
+    LatencyHistogram capture_to_first_sent {}, encoded_to_first_sent {}, first_sent_to_acked {};
+  };
+
 private:
   Statistics stats_ {};
+  LatencyStatistics latency_ {};
 
 public:
   template<class SourceType>
@@ -71,19 +138,29 @@ public:
       throw std::runtime_error( "NetworkSender internal error: next_frame_index_ < frames_.range_begin()" );
     }
 
-    if ( need_immediate_send_ ) {
+    if ( need_immediate_send_ and not coalescing_deadline_ns_.has_value() ) {
       throw std::runtime_error( "packet pushed but not sent" );
     }
 
     if ( next_frame_index_ >= frames_.range_end() ) {
       const size_t frames_to_drop = next_frame_index_ - frames_.range_end() + 1;
+      for ( uint32_t i = frames_.range_begin(); i < frames_.range_begin() + frames_to_drop; i++ ) {
+        forget_unsent( frame_status_[i] );
+        needs_send_[size_class( frames_[i].serialized_length() )].reset( i );
+      }
       frames_.pop( frames_to_drop );
       frame_status_.pop( frames_to_drop );
       stats_.frames_dropped += frames_to_drop;
     }
 
     frames_.at( next_frame_index_ ) = encoder.front( next_frame_index_ );
-    frame_status_.at( next_frame_index_ ) = { true, false };
+    frame_status_.at( next_frame_index_ ) = { true, false, 0 };
+    update_needs_send( next_frame_index_ );
+
+    if ( unsent_frames_++ == 0 ) {
+      oldest_unsent_timestamp_ = Timer::timestamp_ns();
+    }
+
     next_frame_index_++;
 
     need_immediate_send_ = true;
@@ -94,7 +171,34 @@ public:
   void set_sender_section( typename Packet<FrameType>::SenderSection& p );
   void receive_receiver_section( const typename Packet<FrameType>::ReceiverSection& receiver_section );
 
+  /* the room for frames in each packet (see max_frames_length()): frames that don't fit wait for another */
+  void set_max_frames_length( const uint16_t length ) { max_frames_length_ = length; }
+
+  /* in coalescing mode (with a deadline), frames can be pushed without sending a packet after each: the
+     caller sends when the next frame won't fit (has_room_for), when the packet is full, or when the oldest
+     frame waiting has waited for the deadline (coalesced_packet_due). Both tests go by what the next
+     packet would really carry, retransmissions included: a frame "fits" if, pushed now, it and every frame
+     not yet sent would go out together. */
+  void set_coalescing( const std::optional<uint64_t> deadline_ns ) { coalescing_deadline_ns_ = deadline_ns; }
+  bool coalescing() const { return coalescing_deadline_ns_.has_value(); }
+
+  bool has_room_for( const uint32_t frame_length ) const;
+  bool packet_full() const;
+  bool coalesced_packet_due( const uint64_t now ) const;
+  uint64_t coalescing_wait_ms( const uint64_t now ) const;
+
+  /* let a congestion controller gate sending (through ready_to_send) */
+  void set_congestion_controller( std::unique_ptr<CongestionController> controller );
+  const CongestionController* congestion_controller() const { return congestion_control_.get(); }
+
+  /* whether the congestion controller allows a packet now: the window has room (or no ACK has come for a
+     while, so a packet goes out to find out why). Pacing is up to the source (VideoSource's pacer, at the
+     controller's pacing rate). */
+  bool ready_to_send( const uint64_t now ) const;
+  uint64_t wait_time_ms( const uint64_t now ) const;
+
   void summary( std::ostream& out ) const;
 
   const Statistics& stats() const { return stats_; }
+  const LatencyStatistics& latency() const { return latency_; }
 };
@@ -0,0 +1,82 @@
+#include <utility>
+
+#include "buffer_pool.hh"
+
+using namespace std;
+
+PooledBuffer BufferPool::take( const string_view contents )
+{
+  Slot* slot {};
+  {
+    const lock_guard lock { mutex_ };
+    if ( free_.empty() ) {
+      slots_.push_back( make_unique<Slot>() );
+      free_.reserve( slots_.size() ); /* so giving buffers back never allocates */
+      slot = slots_.back().get();
+    } else {
+      slot = free_.back();
+      free_.pop_back();
+    }
+  }
+
+  slot->storage.assign( contents.begin(), contents.end() );
+  return { shared_from_this(), slot };
+}
+
+void BufferPool::give_back( Slot* slot )
+{
+  const lock_guard lock { mutex_ };
+  free_.push_back( slot );
+}
+
+size_t BufferPool::num_buffers()
+{
+  const lock_guard lock { mutex_ };
+  return slots_.size();
+}
+
+PooledBuffer::PooledBuffer( shared_ptr<BufferPool> pool, BufferPool::Slot* slot )
+  : pool_( move( pool ) ), slot_( slot )
+{
+  slot_->references.store( 1, memory_order_relaxed );
+}
+
+void PooledBuffer::release()
+{
+  if ( slot_ and slot_->references.fetch_sub( 1, memory_order_acq_rel ) == 1 ) {
+    pool_->give_back( slot_ );
+  }
+
+  slot_ = nullptr;
+  pool_.reset();
+}
+
+PooledBuffer::PooledBuffer( const PooledBuffer& other ) : pool_( other.pool_ ), slot_( other.slot_ )
+{
+  if ( slot_ ) {
+    slot_->references.fetch_add( 1, memory_order_relaxed );
+  }
+}
+
+PooledBuffer& PooledBuffer::operator=( const PooledBuffer& other )
+{
+  if ( this != &other ) {
+    PooledBuffer copy { other };
+    *this = move( copy );
+  }
+  return *this;
+}
+
+PooledBuffer::PooledBuffer( PooledBuffer&& other ) noexcept
+  : pool_( move( other.pool_ ) ), slot_( exchange( other.slot_, nullptr ) )
+{}
+
+PooledBuffer& PooledBuffer::operator=( PooledBuffer&& other ) noexcept
+{
+  if ( this != &other ) {
+    release();
+    pool_ = move( other.pool_ );
+    slot_ = exchange( other.slot_, nullptr );
+  }
+  return *this;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <vector>
+
+class PooledBuffer;
+
+//! Reusable byte buffers, shared by reference count: a buffer goes back to the pool when the last
+//! PooledBuffer referring to it is dropped. Buffers keep their capacity, so once the pool has warmed up,
+//! taking and filling one allocates nothing. Buffers can be taken and dropped on different threads.
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+  friend class PooledBuffer;
+
+  struct Slot
+  {
+    std::vector<char> storage {};
+    std::atomic<unsigned int> references { 0 };
+  };
+
+  std::mutex mutex_ {};
+  std::vector<std::unique_ptr<Slot>> slots_ {};
+  std::vector<Slot*> free_ {};
+
+  void give_back( Slot* slot );
+
+  struct Private
+  {};
+
+public:
+  //! Pools are always held by shared_ptr (each buffer keeps its pool alive); use make()
+  explicit BufferPool( Private ) {}
+  static std::shared_ptr<BufferPool> make() { return std::make_shared<BufferPool>( Private {} ); }
+
+  //! A buffer holding a copy of `contents`
+  PooledBuffer take( const std::string_view contents );
+
+  //! Buffers made so far (in use or free)
+  size_t num_buffers();
+
+  BufferPool( const BufferPool& other ) = delete;
+  BufferPool& operator=( const BufferPool& other ) = delete;
+};
+
+//! A reference to a buffer from a BufferPool (or to nothing). Copies refer to the same bytes.
+class PooledBuffer
+{
+  friend class BufferPool;
+
+  std::shared_ptr<BufferPool> pool_ {};
+  BufferPool::Slot* slot_ {};
+
+  PooledBuffer( std::shared_ptr<BufferPool> pool, BufferPool::Slot* slot );
+  void release();
+
+public:
+  PooledBuffer() {}
+  ~PooledBuffer() { release(); }
+
+  PooledBuffer( const PooledBuffer& other );
+  PooledBuffer& operator=( const PooledBuffer& other );
+  PooledBuffer( PooledBuffer&& other ) noexcept;
+  PooledBuffer& operator=( PooledBuffer&& other ) noexcept;
+
+  bool empty() const { return slot_ == nullptr; }
+  std::string_view view() const
+  {
+    return slot_ ? std::string_view { slot_->storage.data(), slot_->storage.size() } : std::string_view {};
+  }
+};
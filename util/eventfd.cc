@@ -0,0 +1,33 @@
+#include <sys/eventfd.h>
+
+#include "eventfd.hh"
+#include "exception.hh"
+
+using namespace std;
+
+EventFD::EventFD()
+  : FileDescriptor( ::CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
+{}
+
+void EventFD::signal()
+{
+  const uint64_t one = 1;
+  if ( write( { reinterpret_cast<const char*>( &one ), sizeof( one ) } ) != sizeof( one ) ) {
+    throw runtime_error( "EventFD: short write" );
+  }
+}
+
+uint64_t EventFD::read_event()
+{
+  uint64_t value = 0;
+  const size_t bytes_read = read( { reinterpret_cast<char*>( &value ), sizeof( value ) } );
+  if ( bytes_read == 0 ) {
+    return 0;
+  }
+
+  if ( bytes_read != sizeof( value ) ) {
+    throw runtime_error( "EventFD: short read" );
+  }
+
+  return value;
+}
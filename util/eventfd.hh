@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#include "file_descriptor.hh"
+
+//! A non-blocking [eventfd(2)](\ref man2::eventfd), used to wake an EventLoop from another thread
+class EventFD : public FileDescriptor
+{
+public:
+  EventFD();
+
+  //! Add one to the counter, making the fd readable
+  void signal();
+
+  //! Consume the counter
+  //! \returns value of the counter (0 if not signalled)
+  uint64_t read_event();
+};
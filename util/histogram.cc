@@ -0,0 +1,83 @@
+#include <bit>
+
+#include "histogram.hh"
+#include "timer.hh"
+
+using namespace std;
+
+unsigned int LatencyHistogram::bucket_of( const uint64_t duration_ns )
+{
+  constexpr uint64_t sub_buckets = 1 << SUB_BITS;
+  if ( duration_ns < sub_buckets ) {
+    return duration_ns;
+  }
+
+  const unsigned int exponent = bit_width( duration_ns ) - 1;
+  const unsigned int mantissa = ( duration_ns >> ( exponent - SUB_BITS ) ) & ( sub_buckets - 1 );
+  return ( ( exponent - SUB_BITS + 1 ) << SUB_BITS ) + mantissa;
+}
+
+uint64_t LatencyHistogram::bucket_midpoint( const unsigned int bucket )
+{
+  constexpr uint64_t sub_buckets = 1 << SUB_BITS;
+  if ( bucket < sub_buckets ) {
+    return bucket;
+  }
+
+  const unsigned int exponent = ( bucket >> SUB_BITS ) + SUB_BITS - 1;
+  const uint64_t mantissa = bucket & ( sub_buckets - 1 );
+  const unsigned int shift = exponent - SUB_BITS;
+  const uint64_t lower = ( sub_buckets + mantissa ) << shift;
+  return lower + ( ( uint64_t( 1 ) << shift ) >> 1 );
+}
+
+void LatencyHistogram::record( const uint64_t duration_ns )
+{
+  counts_[bucket_of( duration_ns )]++;
+  count_++;
+  total_ns_ += duration_ns;
+  max_ns_ = max( max_ns_, duration_ns );
+}
+
+void LatencyHistogram::reset()
+{
+  counts_.fill( 0 );
+  count_ = total_ns_ = max_ns_ = 0;
+}
+
+uint64_t LatencyHistogram::percentile_ns( const double fraction ) const
+{
+  if ( count_ == 0 ) {
+    return 0;
+  }
+
+  const uint64_t rank = max( uint64_t( 1 ), uint64_t( fraction * count_ + 0.5 ) );
+  uint64_t seen = 0;
+  for ( unsigned int bucket = 0; bucket < NUM_BUCKETS; bucket++ ) {
+    seen += counts_[bucket];
+    if ( seen >= rank ) {
+      return min( bucket_midpoint( bucket ), max_ns_ );
+    }
+  }
+
+  return max_ns_;
+}
+
+void LatencyHistogram::summary( ostream& out ) const
+{
+  out << "n=" << count_;
+  if ( count_ == 0 ) {
+    return;
+  }
+
+  out << " mean=";
+  Timer::pp_ns( out, mean_ns() );
+  out << " p50=";
+  Timer::pp_ns( out, percentile_ns( 0.5 ) );
+  out << " p90=";
+  Timer::pp_ns( out, percentile_ns( 0.9 ) );
+  out << " p99=";
+  Timer::pp_ns( out, percentile_ns( 0.99 ) );
+  out << " max=";
+  Timer::pp_ns( out, max_ns_ );
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+//! Histogram of durations in ns with log-linear buckets (16 per power of two, so within ~6%)
+class LatencyHistogram
+{
+  static constexpr unsigned int SUB_BITS = 4;
+  static constexpr unsigned int NUM_BUCKETS = ( 64 - SUB_BITS + 1 ) << SUB_BITS;
+
+  std::array<uint64_t, NUM_BUCKETS> counts_ {};
+  uint64_t count_ {}, total_ns_ {}, max_ns_ {};
+
+  static unsigned int bucket_of( const uint64_t duration_ns );
+  static uint64_t bucket_midpoint( const unsigned int bucket );
+
+public:
+  void record( const uint64_t duration_ns );
+  void reset();
+
+  uint64_t count() const { return count_; }
+  uint64_t mean_ns() const { return count_ ? total_ns_ / count_ : 0; }
+  uint64_t max_ns() const { return max_ns_; }
+
+  //! \param[in] fraction e.g. 0.99 for the 99th percentile
+  uint64_t percentile_ns( const double fraction ) const;
+
+  //! One line: count, mean, p50/p90/p99 and max
+  void summary( std::ostream& out ) const;
+};
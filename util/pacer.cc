@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "pacer.hh"
+
+using namespace std;
+
+Pacer::Pacer() : Pacer( Config {} ) {}
+
+Pacer::Pacer( const Config& config ) : config_( config ), tokens_( config.burst_bytes )
+{
+  if ( config_.rate_bps == 0 or config_.burst_bytes == 0 ) {
+    throw runtime_error( "Pacer: rate and burst must be positive" );
+  }
+}
+
+double Pacer::tokens( const uint64_t now ) const
+{
+  if ( now <= last_refill_ ) {
+    return tokens_;
+  }
+
+  return min( double( config_.burst_bytes ), tokens_ + ( now - last_refill_ ) * config_.rate_bps / 8e9 );
+}
+
+void Pacer::set_rate( const uint64_t rate_bps, const uint64_t now )
+{
+  if ( rate_bps == 0 ) {
+    throw runtime_error( "Pacer: rate must be positive" );
+  }
+
+  tokens_ = tokens( now );
+  last_refill_ = max( last_refill_, now );
+  config_.rate_bps = rate_bps;
+}
+
+void Pacer::reset( const uint64_t rate_bps, const uint64_t now )
+{
+  set_rate( rate_bps, now );
+  tokens_ = config_.burst_bytes;
+}
+
+bool Pacer::ready( const size_t bytes, const uint64_t now ) const
+{
+  /* a send bigger than the burst allowance goes once the bucket is full */
+  return tokens( now ) >= min( double( bytes ), double( config_.burst_bytes ) );
+}
+
+uint64_t Pacer::wait_time_ns( const size_t bytes, const uint64_t now ) const
+{
+  const double missing = min( double( bytes ), double( config_.burst_bytes ) ) - tokens( now );
+  if ( missing <= 0 ) {
+    return 0;
+  }
+
+  return ceil( missing * 8e9 / config_.rate_bps );
+}
+
+void Pacer::consume( const size_t bytes, const uint64_t now )
+{
+  /* may go into debt (a send bigger than the allowance), which later sends wait off */
+  tokens_ = tokens( now ) - bytes;
+  last_refill_ = max( last_refill_, now );
+}
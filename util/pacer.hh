@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//! A token bucket: sending costs a token per byte, and tokens come back at the pacing rate, up to a burst
+//! allowance. Sends within the allowance go at once; beyond it, they are spaced out at the rate.
+class Pacer
+{
+public:
+  struct Config
+  {
+    uint64_t rate_bps { 20'000'000 };
+    uint32_t burst_bytes { 8192 };
+  };
+
+private:
+  Config config_;
+  double tokens_;
+  uint64_t last_refill_ {};
+
+  double tokens( const uint64_t now ) const;
+
+public:
+  Pacer();
+  explicit Pacer( const Config& config );
+
+  //! Change the rate (e.g. to a congestion controller's); tokens earned so far at the old rate are kept
+  void set_rate( const uint64_t rate_bps, const uint64_t now );
+  uint64_t rate_bps() const { return config_.rate_bps; }
+
+  //! Start afresh at `rate_bps` with a full bucket, forgetting any debt (e.g. for a new connection)
+  void reset( const uint64_t rate_bps, const uint64_t now );
+
+  bool ready( const size_t bytes, const uint64_t now ) const;
+
+  //! How long until `bytes` may be sent (0 if they may now)
+  uint64_t wait_time_ns( const size_t bytes, const uint64_t now ) const;
+
+  void consume( const size_t bytes, const uint64_t now );
+};
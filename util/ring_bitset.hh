@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+//! A set of indices from a sliding window of `capacity` (like an EndlessBuffer's range), kept as a bitmap
+//! with a second-level map of which words are nonempty. Finding the first member in a range takes a
+//! few word operations (capacity / 4096 of them at most), however many indices are in it.
+template<size_t capacity>
+class RingBitset
+{
+  static constexpr size_t word_bits = 64;
+  static constexpr size_t num_words = capacity / word_bits;
+  static constexpr size_t num_summary_words = ( num_words + word_bits - 1 ) / word_bits;
+
+  static_assert( capacity > 0 and capacity % word_bits == 0, "RingBitset capacity must be a multiple of 64" );
+
+  std::array<uint64_t, num_words> words_ {};
+  std::array<uint64_t, num_summary_words> nonempty_words_ {};
+
+  /* first member in [begin, end) of the ring positions, with begin < end <= capacity */
+  std::optional<size_t> find_in_positions( const size_t begin, const size_t end ) const
+  {
+    std::optional<size_t> ret;
+
+    const size_t word = begin / word_bits;
+    const uint64_t here = words_[word] & ( ~uint64_t( 0 ) << ( begin % word_bits ) );
+    if ( here ) {
+      ret = word * word_bits + std::countr_zero( here );
+    } else {
+      /* the next nonempty word, from the summary */
+      for ( size_t next = word + 1; next < num_words; ) {
+        const uint64_t summary
+          = nonempty_words_[next / word_bits] & ( ~uint64_t( 0 ) << ( next % word_bits ) );
+        if ( summary ) {
+          const size_t found = ( next / word_bits ) * word_bits + std::countr_zero( summary );
+          ret = found * word_bits + std::countr_zero( words_[found] );
+          break;
+        }
+        next = ( next / word_bits + 1 ) * word_bits;
+      }
+    }
+
+    if ( ret.has_value() and ret.value() >= end ) {
+      ret.reset();
+    }
+
+    return ret;
+  }
+
+public:
+  bool test( const size_t index ) const
+  {
+    return words_[( index % capacity ) / word_bits] >> ( index % word_bits ) & 1;
+  }
+
+  void set( const size_t index )
+  {
+    const size_t word = ( index % capacity ) / word_bits;
+    words_[word] |= uint64_t( 1 ) << ( index % word_bits );
+    nonempty_words_[word / word_bits] |= uint64_t( 1 ) << ( word % word_bits );
+  }
+
+  void reset( const size_t index )
+  {
+    const size_t word = ( index % capacity ) / word_bits;
+    words_[word] &= ~( uint64_t( 1 ) << ( index % word_bits ) );
+    if ( not words_[word] ) {
+      nonempty_words_[word / word_bits] &= ~( uint64_t( 1 ) << ( word % word_bits ) );
+    }
+  }
+
+  void assign( const size_t index, const bool value ) { value ? set( index ) : reset( index ); }
+
+  //! The smallest member in [begin, end), which must span no more than the capacity
+  std::optional<size_t> find_first( const size_t begin, const size_t end ) const
+  {
+    if ( begin >= end ) {
+      return {};
+    }
+
+    /* the range is at most two runs of ring positions: to the end of the ring, then from its start */
+    const size_t first = begin % capacity;
+    const size_t length = end - begin;
+    std::optional<size_t> position = find_in_positions( first, std::min( capacity, first + length ) );
+    if ( not position.has_value() and first + length > capacity ) {
+      position = find_in_positions( 0, first + length - capacity );
+      if ( position.has_value() ) {
+        return begin + ( capacity - first ) + position.value();
+      }
+    }
+
+    if ( position.has_value() ) {
+      return begin + ( position.value() - first );
+    }
+
+    return {};
+  }
+};
@@ -3,6 +3,7 @@
 #include "exception.hh"
 
 #include <cstddef>
+#include <netinet/in.h>
 #include <stdexcept>
 #include <unistd.h>
 
@@ -168,6 +169,28 @@ void UDPSocket::send( const string_view payload )
   register_write();
 }
 
+unsigned int UDPSocket::mtu() const
+{
+  int domain = 0;
+  getsockopt( SOL_SOCKET, SO_DOMAIN, domain );
+
+  int mtu = 0;
+  socklen_t len = 0;
+  if ( domain == AF_INET ) {
+    len = getsockopt( IPPROTO_IP, IP_MTU, mtu );
+  } else if ( domain == AF_INET6 ) {
+    len = getsockopt( IPPROTO_IPV6, IPV6_MTU, mtu );
+  } else {
+    throw runtime_error( "UDPSocket::mtu(): not an IP socket" );
+  }
+
+  if ( len != sizeof( mtu ) or mtu <= 0 ) {
+    throw runtime_error( "unexpected result from getsockopt(IP_MTU/IPV6_MTU)" );
+  }
+
+  return mtu;
+}
+
 size_t UDPSocket::recv( Address& source_address, span<char> payload )
 {
   // receive source address and payload
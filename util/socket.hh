@@ -73,6 +73,11 @@ public:
 
   //! Send datagram to the socket's connected address (must call connect() first)
   void send( const std::string_view payload );
+
+  //! The path MTU the kernel knows for the connected address: the outgoing interface's, unless it has
+  //! learned of a smaller one, via [IP_MTU](\ref man7::ip) or [IPV6_MTU](\ref man7::ipv6) (must call
+  //! connect() first)
+  unsigned int mtu() const;
 };
 
 //! A wrapper around [TCP sockets](\ref man7::tcp)
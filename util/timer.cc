@@ -2,12 +2,20 @@
 #include "exception.hh"
 
 #include <cstring>
+#include <ctime>
 #include <iomanip>
 #include <iostream>
 #include <ostream>
 
 using namespace std;
 
+uint64_t Timer::process_cpu_ns()
+{
+  timespec ts {};
+  CheckSystemCall( "clock_gettime", clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts ) );
+  return ts.tv_sec * 1'000'000'000ULL + ts.tv_nsec;
+}
+
 void Timer::summary( ostream& out ) const
 {
   const uint64_t now = timestamp_ns();
@@ -22,6 +22,9 @@ public:
     return std::chrono::steady_clock::now().time_since_epoch().count();
   }
 
+  //! CPU time used so far by all of the process's threads
+  static uint64_t process_cpu_ns();
+
   static void pp_ns( std::ostream& out, const uint64_t duration_ns )
   {
     out << std::fixed << std::setprecision( 1 ) << std::setw( 5 ) << std::setfill( ' ' );
@@ -0,0 +1,37 @@
+#include <sys/timerfd.h>
+
+#include "exception.hh"
+#include "timerfd.hh"
+
+using namespace std;
+
+static timespec to_timespec( const uint64_t ns )
+{
+  return { static_cast<time_t>( ns / 1'000'000'000 ), static_cast<long>( ns % 1'000'000'000 ) };
+}
+
+TimerFD::TimerFD()
+  : FileDescriptor( ::CheckSystemCall( "timerfd_create",
+                                       timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) )
+{}
+
+void TimerFD::set( const uint64_t initial_ns, const uint64_t interval_ns )
+{
+  const itimerspec spec { to_timespec( interval_ns ), to_timespec( initial_ns ) };
+  CheckSystemCall( "timerfd_settime", timerfd_settime( fd_num(), 0, &spec, nullptr ) );
+}
+
+uint64_t TimerFD::read_event()
+{
+  uint64_t expirations = 0;
+  const size_t bytes_read = read( { reinterpret_cast<char*>( &expirations ), sizeof( expirations ) } );
+  if ( bytes_read == 0 ) {
+    return 0;
+  }
+
+  if ( bytes_read != sizeof( expirations ) ) {
+    throw runtime_error( "TimerFD: short read" );
+  }
+
+  return expirations;
+}
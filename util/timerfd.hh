@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+#include "file_descriptor.hh"
+
+//! A periodic [timerfd(2)](\ref man2::timerfd_create) on CLOCK_MONOTONIC (the same clock as Timer::timestamp_ns)
+class TimerFD : public FileDescriptor
+{
+public:
+  TimerFD();
+
+  //! Arm the timer to fire first after `initial_ns`, then every `interval_ns` (0 = one-shot)
+  void set( const uint64_t initial_ns, const uint64_t interval_ns );
+
+  //! Disarm the timer
+  void disarm() { set( 0, 0 ); }
+
+  //! Consume the pending expirations
+  //! \returns number of expirations since the last read (0 if none)
+  uint64_t read_event();
+};
@@ -12,7 +12,7 @@ class TypedRingStorage : public RingStorage
 {
   static constexpr auto elem_size_ = sizeof( T );
 
-  std::span<T> make_span_from_bytes( std::span<char> in )
+  static std::span<T> make_span_from_bytes( std::span<char> in )
   {
     if ( in.size() % elem_size_ ) {
       throw std::runtime_error( "invalid size " + std::to_string( in.size() ) );
@@ -21,13 +21,13 @@ class TypedRingStorage : public RingStorage
     return { reinterpret_cast<T*>( in.data() ), in.size() / elem_size_ };
   }
 
-  std::span<const T> make_const_span_from_string_view( std::string_view in )
+  static std::span<const T> make_const_span_from_string_view( std::string_view in )
   {
     if ( in.size() % elem_size_ ) {
       throw std::runtime_error( "invalid size " + std::to_string( in.size() ) );
     }
 
-    return { reinterpret_cast<T*>( in.data() ), in.size() / elem_size_ };
+    return { reinterpret_cast<const T*>( in.data() ), in.size() / elem_size_ };
   }
 
 protected:
@@ -64,12 +64,12 @@ public:
 
   std::span<T> writable_region()
   {
-    return TypedRingStorage<T>::mutable_storage( next_index_to_write() ).substr( 0, capacity() - num_stored() );
+    return TypedRingStorage<T>::mutable_storage( next_index_to_write() ).subspan( 0, capacity() - num_stored() );
   }
 
   std::span<const T> writable_region() const
   {
-    return TypedRingStorage<T>::storage( next_index_to_write() ).substr( 0, capacity() - num_stored() );
+    return TypedRingStorage<T>::storage( next_index_to_write() ).subspan( 0, capacity() - num_stored() );
   }
 
   void push( const size_t num_elems )
@@ -83,7 +83,7 @@ public:
 
   std::span<const T> readable_region() const
   {
-    return TypedRingStorage<T>::storage( next_index_to_read() ).substr( 0, num_stored() );
+    return TypedRingStorage<T>::storage( next_index_to_read() ).subspan( 0, num_stored() );
   }
 
   void pop( const size_t num_elems )
@@ -153,14 +153,14 @@ public:
   std::span<const T> region( const size_t pos, const size_t count ) const
   {
     check_bounds( pos, count );
-    return readable_region().substr( pos - range_begin(), count );
+    return readable_region().subspan( pos - range_begin(), count );
   }
 
   T& at( const size_t pos ) { return mutable_region( pos, 1 )[0]; }
   const T& at( const size_t pos ) const { return region( pos, 1 )[0]; }
 
-  const T& operator[]( const size_t pos ) const { return readable_region().substr( pos - range_begin(), 1 )[0]; }
-  T& operator[]( const size_t pos ) { return readable_region().substr( pos - range_begin(), 1 )[0]; }
+  const T& operator[]( const size_t pos ) const { return readable_region().subspan( pos - range_begin(), 1 )[0]; }
+  T& operator[]( const size_t pos ) { return mutable_readable_region().subspan( pos - range_begin(), 1 )[0]; }
 };
 
 template<typename T>
@@ -175,7 +175,7 @@ public:
       return {};
     }
 
-    return EndlessBuffer<T>::region( pos, 1 ).at( 0 );
+    return EndlessBuffer<T>::region( pos, 1 )[0];
   }
 
   void safe_set( const size_t pos, const T& val )
@@ -184,6 +184,6 @@ public:
       return;
     }
 
-    EndlessBuffer<T>::region( pos, 1 ).at( 0 ) = val;
+    EndlessBuffer<T>::mutable_region( pos, 1 )[0] = val;
   }
 };
@@ -0,0 +1,98 @@
+#include <stdexcept>
+#include <utility>
+
+#include "worker_pool.hh"
+
+using namespace std;
+
+WorkerPool::WorkerPool( const unsigned int num_threads )
+{
+  if ( num_threads == 0 ) {
+    throw runtime_error( "WorkerPool needs at least one thread" );
+  }
+
+  workers_.reserve( num_threads - 1 );
+  for ( unsigned int i = 1; i < num_threads; i++ ) {
+    workers_.emplace_back( [this] { worker_loop(); } );
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    const lock_guard lock { mutex_ };
+    shutting_down_ = true;
+  }
+  job_posted_.notify_all();
+
+  for ( auto& worker : workers_ ) {
+    worker.join();
+  }
+}
+
+void WorkerPool::run_parts( unique_lock<mutex>& lock )
+{
+  while ( next_part_ < num_parts_ ) {
+    const unsigned int index = next_part_++;
+    const auto& part = *part_;
+
+    lock.unlock();
+    exception_ptr error;
+    try {
+      part( index );
+    } catch ( ... ) {
+      error = current_exception();
+    }
+    lock.lock();
+
+    if ( error and not error_ ) {
+      error_ = error;
+    }
+
+    if ( --parts_outstanding_ == 0 ) {
+      job_finished_.notify_all();
+    }
+  }
+}
+
+void WorkerPool::worker_loop()
+{
+  unique_lock lock { mutex_ };
+  uint64_t generation_seen = generation_;
+
+  while ( true ) {
+    job_posted_.wait( lock, [&] { return shutting_down_ or generation_ != generation_seen; } );
+    if ( shutting_down_ ) {
+      return;
+    }
+
+    generation_seen = generation_;
+    run_parts( lock );
+  }
+}
+
+void WorkerPool::run( const unsigned int num_parts, const function<void( unsigned int )>& part )
+{
+  unique_lock lock { mutex_ };
+
+  part_ = &part;
+  num_parts_ = num_parts;
+  next_part_ = 0;
+  parts_outstanding_ = num_parts;
+  error_ = nullptr;
+  generation_++;
+
+  if ( num_parts > 1 ) {
+    job_posted_.notify_all();
+  }
+
+  run_parts( lock );
+  job_finished_.wait( lock, [&] { return parts_outstanding_ == 0; } );
+
+  part_ = nullptr;
+  num_parts_ = next_part_ = 0;
+
+  if ( error_ ) {
+    rethrow_exception( exchange( error_, nullptr ) );
+  }
+}
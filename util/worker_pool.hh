@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! A fixed set of threads that split one job into parts and run them in parallel.
+//! The calling thread takes parts too, so a pool of N threads starts N-1 workers.
+class WorkerPool
+{
+  std::vector<std::thread> workers_ {};
+
+  std::mutex mutex_ {};
+  std::condition_variable job_posted_ {};
+  std::condition_variable job_finished_ {};
+
+  /* the current job (all protected by mutex_) */
+  const std::function<void( unsigned int )>* part_ {};
+  unsigned int num_parts_ {};
+  unsigned int next_part_ {};
+  unsigned int parts_outstanding_ {};
+  uint64_t generation_ {};
+  std::exception_ptr error_ {};
+  bool shutting_down_ {};
+
+  void worker_loop();
+
+  /* claim and run parts of the current job until none are left */
+  void run_parts( std::unique_lock<std::mutex>& lock );
+
+public:
+  //! \param[in] num_threads total threads that run parts, including the caller of run()
+  explicit WorkerPool( const unsigned int num_threads );
+  ~WorkerPool();
+
+  unsigned int num_threads() const { return workers_.size() + 1; }
+
+  //! Run `part( 0 )` ... `part( num_parts - 1 )` across the pool, returning once all have finished.
+  //! If any part throws, the first exception is rethrown here (after the other parts finish).
+  void run( const unsigned int num_parts, const std::function<void( unsigned int )>& part );
+
+  WorkerPool( const WorkerPool& other ) = delete;
+  WorkerPool& operator=( const WorkerPool& other ) = delete;
+};
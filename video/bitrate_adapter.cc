@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "bitrate_adapter.hh"
+#include "timer.hh"
+
+using namespace std;
+
+BitrateAdapter::BitrateAdapter() : BitrateAdapter( Config {} ) {}
+
+BitrateAdapter::BitrateAdapter( const Config& config )
+  : config_( config ), target_kbps_( clamp( config.initial_kbps, config.min_kbps, config.max_kbps ) )
+{
+  if ( config_.min_kbps == 0 or config_.min_kbps > config_.max_kbps ) {
+    throw runtime_error( "BitrateAdapter: invalid bitrate range" );
+  }
+}
+
+optional<unsigned int> BitrateAdapter::update( const Sample& sample )
+{
+  if ( sample.smoothed_rtt_ns > 0 and ( min_rtt_ns_ == 0 or sample.smoothed_rtt_ns < min_rtt_ns_ ) ) {
+    min_rtt_ns_ = sample.smoothed_rtt_ns;
+  }
+
+  /* first sample, or the counters restarted with a new session */
+  if ( not last_sample_.has_value() or sample.packets_sent < last_sample_->packets_sent
+       or sample.packets_acked < last_sample_->packets_acked or sample.bytes_acked < last_sample_->bytes_acked ) {
+    last_sample_ = sample;
+    return {};
+  }
+
+  const Sample& last = last_sample_.value();
+  if ( sample.timestamp < last.timestamp + config_.interval_ns ) {
+    return {};
+  }
+
+  const unsigned int sent = sample.packets_sent - last.packets_sent;
+  const unsigned int acked = sample.packets_acked - last.packets_acked;
+
+  /* the loss count can go down (losses later found to be false positives) */
+  const int lost = int( sample.packets_lost ) - int( last.packets_lost );
+  loss_rate_ = sent ? max( 0, lost ) / float( sent ) : 0;
+
+  /* bits per ms = kbit/s */
+  const double interval_ms = ( sample.timestamp - last.timestamp ) / MILLION;
+  delivery_kbps_ = 8.0 * ( sample.bytes_acked - last.bytes_acked ) / interval_ms;
+  queueing_delay_ns_ = sample.smoothed_rtt_ns > 0 ? sample.smoothed_rtt_ns - min_rtt_ns_ : 0;
+
+  last_sample_ = sample;
+
+  const bool congested = loss_rate_ > config_.loss_threshold
+                         or queueing_delay_ns_ > config_.queueing_delay_threshold_ns or ( sent and not acked );
+  const bool clean = loss_rate_ <= config_.loss_threshold / 2
+                     and queueing_delay_ns_ <= config_.queueing_delay_threshold_ns / 2.0;
+
+  float next = target_kbps_;
+  if ( congested ) {
+    /* back off, to the delivery rate if that is lower (but at most by half at once) */
+    next *= config_.decrease_factor;
+    if ( delivery_kbps_ > 0 and delivery_kbps_ < next ) {
+      next = max( delivery_kbps_, target_kbps_ / 2.0f );
+    }
+  } else if ( clean and delivery_kbps_ >= target_kbps_ / 2.0f ) {
+    /* probe, but only while the encoder is actually using a good part of its budget */
+    next *= config_.increase_factor;
+  }
+
+  const unsigned int next_kbps = clamp( static_cast<unsigned int>( next ), config_.min_kbps, config_.max_kbps );
+  if ( next_kbps == target_kbps_ ) {
+    return {};
+  }
+
+  ( next_kbps < target_kbps_ ? decreases_ : increases_ )++;
+  target_kbps_ = next_kbps;
+  return target_kbps_;
+}
+
+void BitrateAdapter::summary( ostream& out ) const
+{
+  out << "Bitrate adapter: target=" << target_kbps_ << " kbps";
+  out << " delivered=" << static_cast<unsigned int>( delivery_kbps_ ) << " kbps";
+  out << " loss=" << fixed << setprecision( 1 ) << 100 * loss_rate_ << "%";
+  out << " queueing delay=";
+  Timer::pp_ns( out, queueing_delay_ns_ );
+  out << " decreases/increases=" << decreases_ << "/" << increases_ << "\n";
+}
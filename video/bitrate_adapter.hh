@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+#include "summarize.hh"
+
+/* picks the encoder's target bitrate from what NetworkSender sees of the path: on loss, or an RTT
+   growing above the smallest seen (a queue building up), back off towards the measured delivery
+   rate; while the path stays clean and the budget is being used, probe upwards */
+class BitrateAdapter : public Summarizable
+{
+public:
+  struct Config
+  {
+    unsigned int min_kbps { 300 };
+    unsigned int max_kbps { 20'000 };
+    unsigned int initial_kbps { 4000 };
+
+    uint64_t interval_ns { 250'000'000 }; /* decide at most this often */
+
+    float loss_threshold { 0.05 };                       /* back off above this loss rate... */
+    uint64_t queueing_delay_threshold_ns { 30'000'000 }; /* ...or this much RTT above the minimum */
+
+    float decrease_factor { 0.85 };
+    float increase_factor { 1.05 };
+  };
+
+  /* a snapshot of the sender's counters */
+  struct Sample
+  {
+    uint64_t timestamp;
+    unsigned int packets_sent, packets_lost, packets_acked;
+    uint64_t bytes_acked;
+    float smoothed_rtt_ns;
+  };
+
+  template<class SenderStatistics>
+  static Sample sample( const SenderStatistics& stats, const uint64_t now )
+  {
+    return { now,
+             stats.packet_transmissions,
+             stats.packet_losses(),
+             stats.packets_acked,
+             stats.frame_bytes_acked,
+             stats.smoothed_rtt };
+  }
+
+private:
+  Config config_;
+  unsigned int target_kbps_;
+
+  std::optional<Sample> last_sample_ {};
+  float min_rtt_ns_ {};
+
+  /* what the last decision saw */
+  float loss_rate_ {}, delivery_kbps_ {}, queueing_delay_ns_ {};
+  unsigned int decreases_ {}, increases_ {};
+
+public:
+  BitrateAdapter();
+  explicit BitrateAdapter( const Config& config );
+
+  /* feed a new sample; returns the new target (kbps) if it changed */
+  std::optional<unsigned int> update( const Sample& sample );
+
+  unsigned int target_kbps() const { return target_kbps_; }
+
+  void summary( std::ostream& out ) const override;
+};
@@ -1,5 +1,6 @@
 #include "camera.hh"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <fcntl.h>
@@ -10,51 +11,38 @@
 #include <iostream>
 
 #include "exception.hh"
+#include "timer.hh"
 
 using namespace std;
 
-static constexpr int capture_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
 Camera::Camera( const uint16_t width,
                 const uint16_t height,
                 const string& device_name,
                 const uint32_t pixel_format,
                 const unsigned int frame_rate )
+  : Camera( width, height, device_name, vector<uint32_t> { pixel_format }, frame_rate )
+{}
+
+Camera::Camera( const uint16_t width,
+                const uint16_t height,
+                const string& device_name,
+                const vector<uint32_t>& acceptable_pixel_formats,
+                const unsigned int frame_rate )
   : width_( width )
   , height_( height )
-  , pixel_format_( pixel_format )
   , device_name_( device_name )
   , camera_fd_( CheckSystemCall( "open camera", open( device_name.c_str(), O_RDWR ) ) )
   , kernel_v4l2_buffers_()
 {
   camera_fd_.set_blocking( false );
 
-  v4l2_capability cap {};
-  CheckSystemCall( "ioctl", ioctl( camera_fd_.fd_num(), VIDIOC_QUERYCAP, &cap ) );
-
-  if ( not( cap.capabilities & V4L2_CAP_VIDEO_CAPTURE ) ) {
-    throw runtime_error( "this device does not handle video capture" );
-  }
-
-  /* setting the output format and size */
-  v4l2_format format {};
-  format.type = capture_type;
-  format.fmt.pix.pixelformat = pixel_format;
-  format.fmt.pix.width = width_;
-  format.fmt.pix.height = height_;
-
-  CheckSystemCall( "setting format", ioctl( camera_fd_.fd_num(), VIDIOC_S_FMT, &format ) );
-
-  if ( format.fmt.pix.pixelformat != pixel_format or format.fmt.pix.width != width_
-       or format.fmt.pix.height != height_ ) {
-    throw runtime_error( "couldn't configure the camera with the given format" );
-  }
+  negotiate_format( acceptable_pixel_formats );
 
   /* setting capture parameters */
   v4l2_streamparm params {};
-  params.type = capture_type;
+  params.type = buffer_type_;
   CheckSystemCall( "getting capture params", ioctl( camera_fd_.fd_num(), VIDIOC_G_PARM, &params ) );
-  if ( params.type != capture_type ) {
+  if ( params.type != buffer_type_ ) {
     throw runtime_error( "bad v4l2_streamparm" );
   }
   if ( not( params.parm.capture.capability & V4L2_CAP_TIMEPERFRAME ) ) {
@@ -71,13 +59,113 @@ Camera::Camera( const uint16_t width,
   init();
 }
 
+void Camera::negotiate_format( const vector<uint32_t>& acceptable_pixel_formats )
+{
+  v4l2_capability cap {};
+  CheckSystemCall( "ioctl", ioctl( camera_fd_.fd_num(), VIDIOC_QUERYCAP, &cap ) );
+
+  const uint32_t capabilities = ( cap.capabilities & V4L2_CAP_DEVICE_CAPS ) ? cap.device_caps : cap.capabilities;
+
+  if ( capabilities & V4L2_CAP_VIDEO_CAPTURE ) {
+    buffer_type_ = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  } else if ( capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE ) {
+    buffer_type_ = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  } else {
+    throw runtime_error( "this device does not handle video capture" );
+  }
+
+  /* which of the acceptable formats does the device offer? */
+  vector<uint32_t> offered_formats;
+  v4l2_fmtdesc description {};
+  description.type = buffer_type_;
+  while ( ioctl( camera_fd_.fd_num(), VIDIOC_ENUM_FMT, &description ) == 0 ) {
+    offered_formats.push_back( description.pixelformat );
+    description.index++;
+  }
+
+  const auto chosen = find_if( acceptable_pixel_formats.begin(), acceptable_pixel_formats.end(), [&]( auto fmt ) {
+    return find( offered_formats.begin(), offered_formats.end(), fmt ) != offered_formats.end();
+  } );
+
+  if ( chosen == acceptable_pixel_formats.end() ) {
+    throw runtime_error( "camera doesn't offer any of the requested pixel formats" );
+  }
+
+  pixel_format_ = *chosen;
+
+  /* setting the output format and size */
+  v4l2_format format {};
+  format.type = buffer_type_;
+
+  if ( multiplanar() ) {
+    format.fmt.pix_mp.pixelformat = pixel_format_;
+    format.fmt.pix_mp.width = width_;
+    format.fmt.pix_mp.height = height_;
+
+    CheckSystemCall( "setting format", ioctl( camera_fd_.fd_num(), VIDIOC_S_FMT, &format ) );
+
+    if ( format.fmt.pix_mp.pixelformat != pixel_format_ or format.fmt.pix_mp.width != width_
+         or format.fmt.pix_mp.height != height_ or format.fmt.pix_mp.num_planes == 0
+         or format.fmt.pix_mp.num_planes > 3 ) {
+      throw runtime_error( "couldn't configure the camera with the given format" );
+    }
+
+    num_memory_planes_ = format.fmt.pix_mp.num_planes;
+    for ( unsigned int i = 0; i < num_memory_planes_; i++ ) {
+      bytes_per_line_.at( i ) = format.fmt.pix_mp.plane_fmt[i].bytesperline;
+    }
+  } else {
+    format.fmt.pix.pixelformat = pixel_format_;
+    format.fmt.pix.width = width_;
+    format.fmt.pix.height = height_;
+
+    CheckSystemCall( "setting format", ioctl( camera_fd_.fd_num(), VIDIOC_S_FMT, &format ) );
+
+    if ( format.fmt.pix.pixelformat != pixel_format_ or format.fmt.pix.width != width_
+         or format.fmt.pix.height != height_ ) {
+      throw runtime_error( "couldn't configure the camera with the given format" );
+    }
+
+    num_memory_planes_ = 1;
+    bytes_per_line_.at( 0 ) = format.fmt.pix.bytesperline;
+  }
+}
+
+Camera::BufferInfo::BufferInfo( const uint32_t type, const unsigned int index )
+{
+  buffer.type = type;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.index = index;
+
+  if ( type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ) {
+    buffer.m.planes = planes.data();
+    buffer.length = planes.size();
+  }
+}
+
+bool Camera::BufferInfo::good() const
+{
+  const uint32_t bytesused
+    = buffer.type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? planes.at( 0 ).bytesused : buffer.bytesused;
+  return not( buffer.flags & V4L2_BUF_FLAG_ERROR ) and bytesused;
+}
+
+uint64_t Camera::BufferInfo::timestamp() const
+{
+  if ( ( buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK ) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC ) {
+    return Timer::timestamp_ns();
+  }
+
+  return uint64_t( buffer.timestamp.tv_sec ) * 1'000'000'000 + uint64_t( buffer.timestamp.tv_usec ) * 1'000;
+}
+
 void Camera::init()
 {
   kernel_v4l2_buffers_.clear();
 
   /* tell the v4l2 about our buffers */
   v4l2_requestbuffers buf_request {};
-  buf_request.type = capture_type;
+  buf_request.type = buffer_type_;
   buf_request.memory = V4L2_MEMORY_MMAP;
   buf_request.count = NUM_BUFFERS;
 
@@ -89,77 +177,73 @@ void Camera::init()
 
   /* allocate buffers */
   for ( unsigned int i = 0; i < NUM_BUFFERS; i++ ) {
-    v4l2_buffer buffer_info {};
-    buffer_info.type = capture_type;
-    buffer_info.memory = V4L2_MEMORY_MMAP;
-    buffer_info.index = i;
-
-    CheckSystemCall( "allocate buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QUERYBUF, &buffer_info ) );
-
-    kernel_v4l2_buffers_.emplace_back(
-      nullptr, buffer_info.length, PROT_READ | PROT_WRITE, MAP_SHARED, camera_fd_.fd_num(), buffer_info.m.offset );
+    BufferInfo info { buffer_type_, i };
+
+    CheckSystemCall( "allocate buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QUERYBUF, &info.buffer ) );
+
+    auto& memory_planes = kernel_v4l2_buffers_.emplace_back();
+    if ( multiplanar() ) {
+      for ( unsigned int p = 0; p < num_memory_planes_; p++ ) {
+        memory_planes.emplace_back( nullptr,
+                                    info.planes.at( p ).length,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED,
+                                    camera_fd_.fd_num(),
+                                    info.planes.at( p ).m.mem_offset );
+      }
+    } else {
+      memory_planes.emplace_back( nullptr,
+                                  info.buffer.length,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED,
+                                  camera_fd_.fd_num(),
+                                  info.buffer.m.offset );
+    }
 
-    CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer_info ) );
+    CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &info.buffer ) );
   }
 
-  CheckSystemCall( "stream on", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMON, &capture_type ) );
+  int type = buffer_type_;
+  CheckSystemCall( "stream on", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMON, &type ) );
 }
 
 Camera::~Camera()
 {
   try {
-    CheckSystemCall( "stream off", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMOFF, &capture_type ) );
+    int type = buffer_type_;
+    CheckSystemCall( "stream off", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMOFF, &type ) );
   } catch ( const exception& e ) {
     cerr << "Camera destructor failed on exception of type " << demangle( typeid( e ).name() ) << ": " << e.what()
          << "\n";
   }
 }
 
-string_view Camera::borrow_next_frame()
+bool Camera::dequeue_frame()
 {
-  v4l2_buffer buffer_info {};
-  buffer_info.type = capture_type;
-  buffer_info.memory = V4L2_MEMORY_MMAP;
-  buffer_info.index = next_buffer_index;
+  BufferInfo info { buffer_type_, next_buffer_index };
 
-  CheckSystemCall( "dequeue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &buffer_info ) );
+  CheckSystemCall( "dequeue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &info.buffer ) );
   camera_fd_.buffer_dequeued();
   frames_dequeued_++;
+  capture_timestamps_.at( info.buffer.index ) = info.timestamp();
 
-  if ( buffer_info.flags & V4L2_BUF_FLAG_ERROR or not buffer_info.bytesused ) {
-    return {};
+  if ( not info.good() ) {
+    return false;
   }
 
   successful_frames_dequeued_++;
-
-  return kernel_v4l2_buffers_.at( next_buffer_index );
+  return true;
 }
 
-string_view Camera::borrow_most_recent_frame()
+void Camera::upgrade_to_most_recent_frame()
 {
-  v4l2_buffer buffer_info {};
-  buffer_info.type = capture_type;
-  buffer_info.memory = V4L2_MEMORY_MMAP;
-  buffer_info.index = next_buffer_index;
-
-  // get one buffer (for sure), then *try* to "upgrade" to a more recent one
-  CheckSystemCall( "dequeue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &buffer_info ) );
-  camera_fd_.buffer_dequeued();
-  frames_dequeued_++;
-
-  if ( buffer_info.flags & V4L2_BUF_FLAG_ERROR or not buffer_info.bytesused ) {
-    return {};
-  }
-
-  successful_frames_dequeued_++;
-
   // "try" to upgrade to a more recent buffer if available
   while ( true ) {
     const unsigned int candidate_new_buffer = ( next_buffer_index + 1 ) % NUM_BUFFERS;
 
     // get another frame
-    buffer_info.index = candidate_new_buffer;
-    auto ret = ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &buffer_info );
+    BufferInfo info { buffer_type_, candidate_new_buffer };
+    auto ret = ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &info.buffer );
     if ( ret < 0 ) {
       if ( errno == EAGAIN ) {
         break;
@@ -170,39 +254,150 @@ string_view Camera::borrow_most_recent_frame()
 
     frames_dequeued_++;
 
-    if ( buffer_info.flags & V4L2_BUF_FLAG_ERROR or not buffer_info.bytesused ) {
+    if ( not info.good() ) {
       // bad frame; stick with the one we have. Release this one.
-      CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer_info ) );
+      CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &info.buffer ) );
       break;
     }
 
     successful_frames_dequeued_++;
     frames_skipped_++;
+    capture_timestamps_.at( candidate_new_buffer ) = info.timestamp();
 
     // there's a new buffer available -- release the one we're holding
-    buffer_info.index = next_buffer_index;
-    CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer_info ) );
+    BufferInfo release_info { buffer_type_, next_buffer_index };
+    CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &release_info.buffer ) );
     next_buffer_index = candidate_new_buffer;
   }
+}
+
+string_view Camera::borrow_next_frame()
+{
+  if ( num_memory_planes_ != 1 ) {
+    throw runtime_error( "Camera: format uses multiple buffers per frame; use borrow_next_planes()" );
+  }
+
+  if ( not dequeue_frame() ) {
+    return {};
+  }
+
+  return kernel_v4l2_buffers_.at( next_buffer_index ).at( 0 );
+}
+
+string_view Camera::borrow_most_recent_frame()
+{
+  if ( num_memory_planes_ != 1 ) {
+    throw runtime_error( "Camera: format uses multiple buffers per frame; use borrow_most_recent_planes()" );
+  }
+
+  // get one buffer (for sure), then *try* to "upgrade" to a more recent one
+  if ( not dequeue_frame() ) {
+    return {};
+  }
+
+  upgrade_to_most_recent_frame();
+
+  return kernel_v4l2_buffers_.at( next_buffer_index ).at( 0 );
+}
+
+FramePlanes Camera::planes_of_buffer( const unsigned int index ) const
+{
+  const auto& memory_planes = kernel_v4l2_buffers_.at( index );
+  const auto plane = [&]( const unsigned int p ) -> FramePlanes::Plane {
+    return { reinterpret_cast<const uint8_t*>( memory_planes.at( p ).addr() ), bytes_per_line_.at( p ) };
+  };
+
+  FramePlanes ret;
+  switch ( pixel_format_ ) {
+    case V4L2_PIX_FMT_NV12M:
+      ret = { V4L2_PIX_FMT_NV12, width_, height_, { plane( 0 ), plane( 1 ) }, 2 };
+      break;
+
+    case V4L2_PIX_FMT_YUV420M:
+      ret = { V4L2_PIX_FMT_YUV420, width_, height_, { plane( 0 ), plane( 1 ), plane( 2 ) }, 3 };
+      break;
+
+    default:
+      ret = contiguous_planes( memory_planes.at( 0 ), pixel_format_, width_, height_, bytes_per_line_.at( 0 ) );
+      break;
+  }
+
+  ret.capture_timestamp = capture_timestamps_.at( index );
+  return ret;
+}
+
+string_view Camera::frame_of_buffer( const unsigned int index ) const
+{
+  if ( num_memory_planes_ != 1 ) {
+    throw runtime_error( "Camera: format uses multiple buffers per frame" );
+  }
+
+  return kernel_v4l2_buffers_.at( index ).at( 0 );
+}
+
+FramePlanes Camera::borrow_next_planes()
+{
+  if ( not dequeue_frame() ) {
+    return {};
+  }
+
+  return planes_of_buffer( next_buffer_index );
+}
+
+FramePlanes Camera::borrow_most_recent_planes()
+{
+  if ( not dequeue_frame() ) {
+    return {};
+  }
 
-  return kernel_v4l2_buffers_.at( next_buffer_index );
+  upgrade_to_most_recent_frame();
+
+  return planes_of_buffer( next_buffer_index );
 }
 
 void Camera::release_frame()
 {
-  v4l2_buffer buffer_info {};
-  buffer_info.type = capture_type;
-  buffer_info.memory = V4L2_MEMORY_MMAP;
-  buffer_info.index = next_buffer_index;
+  BufferInfo info { buffer_type_, next_buffer_index };
 
-  CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer_info ) );
+  CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &info.buffer ) );
 
   next_buffer_index = ( next_buffer_index + 1 ) % NUM_BUFFERS;
 }
 
+optional<Camera::DequeuedBuffer> Camera::try_dequeue_buffer()
+{
+  BufferInfo info { buffer_type_, 0 };
+  if ( ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &info.buffer ) < 0 ) {
+    if ( errno == EAGAIN ) {
+      return {};
+    }
+    throw unix_error( "dequeue buffer", errno );
+  }
+
+  capture_timestamps_.at( info.buffer.index ) = info.timestamp();
+  return DequeuedBuffer { info.buffer.index, info.good() };
+}
+
+void Camera::enqueue_buffer( const unsigned int index )
+{
+  BufferInfo info { buffer_type_, index };
+  CheckSystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &info.buffer ) );
+}
+
+string Camera::description() const
+{
+  const array<char, 4> fourcc { char( pixel_format_ ),
+                                char( pixel_format_ >> 8 ),
+                                char( pixel_format_ >> 16 ),
+                                char( pixel_format_ >> 24 ) };
+
+  return to_string( width_ ) + "x" + to_string( height_ ) + " " + string( fourcc.data(), fourcc.size() )
+         + ( multiplanar() ? " mplane" : "" ) + " on " + device_name_;
+}
+
 void Camera::summary( ostream& out ) const
 {
-  out << "Camera summary (" << width_ << "x" << height_ << " on " << device_name_ << ")"
+  out << "Camera summary (" << description() << ")"
       << "\n------------------------\n\n";
 
   out << "Frame successes/attempts: " << successful_frames_dequeued_ << "/" << frames_dequeued_ << "\n";
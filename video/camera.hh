@@ -27,11 +27,13 @@
 #pragma once
 
 #include "file_descriptor.hh"
+#include "frame_source.hh"
 #include "mmap.hh"
-#include "summarize.hh"
 
+#include <array>
 #include <linux/videodev2.h>
 #include <optional>
+#include <vector>
 
 class CameraFD : public FileDescriptor
 {
@@ -41,26 +43,53 @@ public:
   void buffer_dequeued() { register_read(); }
 };
 
-class Camera : public Summarizable
+class Camera : public FrameSource
 {
 private:
   static constexpr unsigned int NUM_BUFFERS = 16;
 
   uint16_t width_;
   uint16_t height_;
-  uint32_t pixel_format_;
+  uint32_t pixel_format_ {};
   std::string device_name_;
 
   CameraFD camera_fd_;
-  std::vector<MMap_Region> kernel_v4l2_buffers_;
+
+  /* V4L2_BUF_TYPE_VIDEO_CAPTURE, or _MPLANE for devices that only speak the multi-planar API */
+  uint32_t buffer_type_ {};
+  unsigned int num_memory_planes_ { 1 };
+  std::array<unsigned int, VIDEO_MAX_PLANES> bytes_per_line_ {};
+
+  std::vector<std::vector<MMap_Region>> kernel_v4l2_buffers_; /* [buffer][memory plane] */
+  std::array<uint64_t, NUM_BUFFERS> capture_timestamps_ {};    /* of the frame last dequeued into each buffer */
   unsigned int next_buffer_index = 0;
 
+  bool multiplanar() const { return buffer_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; }
+
+  struct BufferInfo
+  {
+    v4l2_buffer buffer {};
+    std::array<v4l2_plane, VIDEO_MAX_PLANES> planes {};
+
+    BufferInfo( const uint32_t type, const unsigned int index );
+    BufferInfo( const BufferInfo& other ) = delete;
+    BufferInfo& operator=( const BufferInfo& other ) = delete;
+
+    bool good() const;
+    uint64_t timestamp() const; /* from the driver when it uses CLOCK_MONOTONIC, else now */
+  };
+
+  void negotiate_format( const std::vector<uint32_t>& acceptable_pixel_formats );
   void init();
 
   unsigned int frames_dequeued_ {};
   unsigned int successful_frames_dequeued_ {};
   unsigned int frames_skipped_ {};
 
+  /* dequeue into next_buffer_index; false on a bad frame */
+  bool dequeue_frame();
+  void upgrade_to_most_recent_frame();
+
 public:
   Camera( const uint16_t width,
           const uint16_t height,
@@ -68,13 +97,45 @@ public:
           const uint32_t pixel_format,
           const unsigned int frame_rate );
 
+  /* pick the first of the acceptable formats (in order of preference) that the device supports */
+  Camera( const uint16_t width,
+          const uint16_t height,
+          const std::string& device_name,
+          const std::vector<uint32_t>& acceptable_pixel_formats,
+          const unsigned int frame_rate );
+
   ~Camera();
 
-  std::string_view borrow_next_frame();
-  std::string_view borrow_most_recent_frame();
-  void release_frame();
+  uint16_t width() const override { return width_; }
+  uint16_t height() const override { return height_; }
+  uint32_t pixel_format() const override { return pixel_format_; }
+
+  /* only for formats delivered in a single buffer */
+  std::string_view borrow_next_frame() override;
+  std::string_view borrow_most_recent_frame() override;
+  void release_frame() override;
+
+  FramePlanes borrow_next_planes() override;
+  FramePlanes borrow_most_recent_planes() override;
+
+  FileDescriptor& fd() override { return camera_fd_; }
+
+  /* "WxH FOURCC on device" */
+  std::string description() const;
+
+  /* low-level buffer access for a thread that owns the device (see ThreadedCamera);
+     these don't touch the frame counters or the fd's read accounting */
+  struct DequeuedBuffer
+  {
+    unsigned int index;
+    bool good; /* false: the driver flagged an error or delivered no data */
+  };
 
-  FileDescriptor& fd() { return camera_fd_; }
+  static constexpr unsigned int num_buffers() { return NUM_BUFFERS; }
+  std::optional<DequeuedBuffer> try_dequeue_buffer(); /* empty if no buffer is ready */
+  void enqueue_buffer( const unsigned int index );
+  FramePlanes planes_of_buffer( const unsigned int index ) const;
+  std::string_view frame_of_buffer( const unsigned int index ) const; /* single-buffer formats only */
 
   void summary( std::ostream& out ) const override;
   void reset_summary() override {};
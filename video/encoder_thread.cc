@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+
+#include "encoder_thread.hh"
+#include "exception.hh"
+
+using namespace std;
+
+EncoderThread::EncoderThread( unique_ptr<H264Encoder> encoder )
+  : encoder_( move( encoder ) ), encoder_thread_()
+{
+  for ( unsigned int i = 0; i < NUM_INPUT_BUFFERS; i++ ) {
+    free_buffers_.push_back( i );
+  }
+
+  /* start last, once everything it uses is in place */
+  encoder_thread_ = thread( [this] { encode_loop(); } );
+}
+
+EncoderThread::~EncoderThread()
+{
+  try {
+    stop_.signal();
+  } catch ( const exception& e ) {
+    cerr << "EncoderThread destructor failed on exception of type " << demangle( typeid( e ).name() ) << ": "
+         << e.what() << "\n";
+  }
+
+  encoder_thread_.join();
+}
+
+void EncoderThread::push( const FramePlanes& frame )
+{
+  check_encoder_thread();
+
+  if ( frame.empty() ) {
+    return;
+  }
+
+  reclaim_returned_buffers();
+  if ( free_buffers_.empty() ) {
+    throw runtime_error( "EncoderThread: no free input buffer" );
+  }
+
+  const unsigned int index = free_buffers_.back();
+  free_buffers_.pop_back();
+
+  /* copy the planes, row by row (the source's rows may be padded) */
+  InputBuffer& buffer = inputs_[index];
+  buffer.storage.resize( raw_frame_size( frame.pixel_format, frame.width, frame.height ) );
+  const string_view storage { reinterpret_cast<const char*>( buffer.storage.data() ), buffer.storage.size() };
+  buffer.frame = contiguous_planes( storage, frame.pixel_format, frame.width, frame.height );
+  buffer.frame.capture_timestamp = frame.capture_timestamp;
+
+  for ( unsigned int i = 0; i < frame.num_planes; i++ ) {
+    const auto& src = frame.planes.at( i );
+    const auto& dst = buffer.frame.planes.at( i );
+    const unsigned int rows = i == 0 ? frame.height : frame.height / 2;
+    for ( unsigned int row = 0; row < rows; row++ ) {
+      memcpy( const_cast<uint8_t*>( dst.data ) + row * dst.stride, src.data + row * src.stride, dst.stride );
+    }
+  }
+
+  frames_pushed_++;
+
+  const uint64_t tail = queue_tail_.load( memory_order_relaxed );
+  uint64_t head = queue_head_.load( memory_order_acquire );
+
+  if ( tail - head == INPUT_QUEUE_DEPTH ) {
+    /* full: take back the oldest frame, unless the encoder thread has just taken it (making room) */
+    const uint32_t oldest = queue_[head % INPUT_QUEUE_DEPTH].load( memory_order_relaxed );
+    if ( queue_head_.compare_exchange_strong( head, head + 1, memory_order_acq_rel ) ) {
+      free_buffers_.push_back( oldest );
+      frames_replaced_++;
+    }
+  }
+
+  queue_[tail % INPUT_QUEUE_DEPTH].store( index, memory_order_relaxed );
+  queue_tail_.store( tail + 1, memory_order_release );
+
+  wake_.signal();
+}
+
+void EncoderThread::post( function<void( H264Encoder& )> command )
+{
+  {
+    lock_guard lock { commands_mutex_ };
+    commands_.push_back( move( command ) );
+  }
+
+  wake_.signal();
+}
+
+void EncoderThread::reclaim_returned_buffers()
+{
+  uint32_t returned = returned_buffers_.exchange( 0, memory_order_acquire );
+  while ( returned ) {
+    free_buffers_.push_back( __builtin_ctz( returned ) );
+    returned &= returned - 1;
+  }
+}
+
+optional<unsigned int> EncoderThread::pop_input()
+{
+  uint64_t head = queue_head_.load( memory_order_acquire );
+  while ( head != queue_tail_.load( memory_order_acquire ) ) {
+    /* if the loop drops this entry and reuses its slot first, the exchange fails and we look again */
+    const uint32_t index = queue_[head % INPUT_QUEUE_DEPTH].load( memory_order_relaxed );
+    if ( queue_head_.compare_exchange_weak( head, head + 1, memory_order_acq_rel, memory_order_acquire ) ) {
+      return index;
+    }
+  }
+
+  return {};
+}
+
+void EncoderThread::run_commands()
+{
+  vector<function<void( H264Encoder& )>> commands;
+  {
+    lock_guard lock { commands_mutex_ };
+    swap( commands, commands_ );
+  }
+
+  for ( const auto& command : commands ) {
+    command( *encoder_ );
+  }
+}
+
+void EncoderThread::encode_loop()
+{
+  try {
+    array<pollfd, 2> fds { { { wake_.fd_num(), POLLIN, 0 }, { stop_.fd_num(), POLLIN, 0 } } };
+
+    while ( true ) {
+      run_commands();
+
+      /* only take a frame if there will be room for what comes out */
+      const uint64_t tail = completed_tail_.load( memory_order_relaxed );
+      const bool room = tail - completed_head_.load( memory_order_acquire ) < COMPLETION_QUEUE_DEPTH;
+
+      if ( const auto index = room ? pop_input() : nullopt ) {
+        const EncodedFrame& encoded = encoder_->encode( inputs_[index.value()].frame );
+
+        /* x264 has its own copy of the picture now */
+        returned_buffers_.fetch_or( 1U << index.value(), memory_order_release );
+        frames_encoded_++;
+
+        if ( not encoded.empty() ) {
+          completions_[tail % COMPLETION_QUEUE_DEPTH] = encoded; /* shares the payload's buffer, no copy */
+          completed_tail_.store( tail + 1, memory_order_release );
+          done_.signal();
+        }
+        continue;
+      }
+
+      if ( poll( fds.data(), fds.size(), -1 ) < 0 ) {
+        if ( errno == EINTR ) {
+          continue;
+        }
+        throw unix_error( "poll" );
+      }
+
+      if ( fds[1].revents ) {
+        return;
+      }
+
+      wake_.read_event();
+    }
+  } catch ( ... ) {
+    encoder_error_ = current_exception();
+    encoder_failed_.store( true, memory_order_release );
+    done_.signal();
+  }
+}
+
+void EncoderThread::check_encoder_thread() const
+{
+  if ( encoder_failed_.load( memory_order_acquire ) ) {
+    rethrow_exception( encoder_error_ );
+  }
+}
+
+void EncoderThread::summary( ostream& out ) const
+{
+  out << "Encoder thread summary\n----------------------\n\n";
+  out << "Frames pushed: " << frames_pushed_ << "\n";
+  out << "Frames replaced while queued: " << frames_replaced_ << "\n";
+  out << "Frames encoded: " << frames_encoded_ << "\n";
+  out << "Frames delivered: " << frames_delivered_ << "\n";
+  out << "Encode time: ";
+  encode_time_.summary( out );
+  out << "\nCapture to delivered: ";
+  capture_to_delivered_.summary( out );
+  out << "\n";
+}
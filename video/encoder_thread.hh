@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "eventfd.hh"
+#include "frame_source.hh"
+#include "h264_encoder.hh"
+#include "histogram.hh"
+#include "summarize.hh"
+#include "timer.hh"
+
+/* runs an H264Encoder on a thread of its own, so a busy encoder doesn't hold up the EventLoop (network
+   receive, ACKs, retransmissions). Frames go in through a short lock-free queue; when it is full, the
+   newest frame replaces the oldest one still waiting. Encoded frames come back through a completion queue,
+   and fd() becomes readable when there are some to collect with drain(). */
+class EncoderThread : public Summarizable
+{
+  static constexpr unsigned int INPUT_QUEUE_DEPTH = 2;
+  static constexpr unsigned int NUM_INPUT_BUFFERS = INPUT_QUEUE_DEPTH + 2; /* + being encoded + being filled */
+  static constexpr unsigned int COMPLETION_QUEUE_DEPTH = 8;
+
+  static_assert( NUM_INPUT_BUFFERS <= 32, "returned_buffers_ needs a bit per buffer" );
+
+  /* a copy of an input frame, tightly packed */
+  struct InputBuffer
+  {
+    std::vector<uint8_t> storage {};
+    FramePlanes frame {};
+  };
+
+  std::unique_ptr<H264Encoder> encoder_;
+
+  std::array<InputBuffer, NUM_INPUT_BUFFERS> inputs_ {};
+  std::vector<unsigned int> free_buffers_ {}; /* the loop's to fill */
+
+  /* loop => encoder thread: indices of filled buffers. Only the loop writes entries and the tail; the head
+     is advanced by the encoder thread to take a frame, or by the loop to drop the oldest. */
+  std::array<std::atomic<uint32_t>, INPUT_QUEUE_DEPTH> queue_ {};
+  std::atomic<uint64_t> queue_head_ { 0 }, queue_tail_ { 0 };
+
+  /* encoder thread => loop: a bit per buffer done with */
+  std::atomic<uint32_t> returned_buffers_ { 0 };
+
+  /* encoder thread => loop: each holds on to its payload's pooled buffer, so the encoder can't reuse it */
+  std::array<EncodedFrame, COMPLETION_QUEUE_DEPTH> completions_ {};
+  std::atomic<uint64_t> completed_head_ { 0 }, completed_tail_ { 0 };
+
+  /* loop => encoder thread: calls to make on the encoder before the next frame */
+  std::mutex commands_mutex_ {};
+  std::vector<std::function<void( H264Encoder& )>> commands_ {};
+
+  EventFD wake_ {}; /* rung for the encoder thread: a new frame, a command, or room for completions */
+  EventFD done_ {};  /* rung for the loop: encoded frames to collect */
+  EventFD stop_ {};
+
+  std::exception_ptr encoder_error_ {};
+  std::atomic<bool> encoder_failed_ { false };
+
+  uint64_t frames_pushed_ {}, frames_replaced_ {}, frames_delivered_ {};
+  std::atomic<uint64_t> frames_encoded_ { 0 };
+  LatencyHistogram encode_time_ {}, capture_to_delivered_ {};
+
+  std::thread encoder_thread_;
+
+  void encode_loop();
+  std::optional<unsigned int> pop_input();
+  void run_commands();
+
+  void reclaim_returned_buffers();
+  void check_encoder_thread() const;
+
+public:
+  explicit EncoderThread( std::unique_ptr<H264Encoder> encoder );
+  ~EncoderThread();
+
+  /* copy a frame in for encoding (the caller can release it straight away) */
+  void push( const FramePlanes& frame );
+
+  /* have the encoder thread make a call on the encoder (e.g. set_target_bitrate or recover) before it
+     encodes its next frame */
+  void post( std::function<void( H264Encoder& )> command );
+
+  FileDescriptor& fd() { return done_; }
+
+  /* when fd() is readable: hand each encoded frame, oldest first, to `deliver` (valid during the call, or
+     for longer through a copy of its storage) */
+  template<class Callback>
+  void drain( Callback&& deliver );
+
+  void summary( std::ostream& out ) const override;
+
+  EncoderThread( const EncoderThread& other ) = delete;
+  EncoderThread& operator=( const EncoderThread& other ) = delete;
+};
+
+template<class Callback>
+void EncoderThread::drain( Callback&& deliver )
+{
+  check_encoder_thread();
+  done_.read_event();
+
+  uint64_t head = completed_head_.load( std::memory_order_relaxed );
+  const uint64_t tail = completed_tail_.load( std::memory_order_acquire );
+  const bool was_full = tail - head == COMPLETION_QUEUE_DEPTH;
+
+  for ( ; head != tail; head++ ) {
+    const EncodedFrame& frame = completions_[head % COMPLETION_QUEUE_DEPTH];
+    encode_time_.record( frame.encode_duration );
+    if ( frame.capture_timestamp ) {
+      capture_to_delivered_.record( Timer::timestamp_ns() - frame.capture_timestamp );
+    }
+    frames_delivered_++;
+
+    deliver( frame );
+    completed_head_.store( head + 1, std::memory_order_release );
+  }
+
+  /* the encoder thread may be waiting for room */
+  if ( was_full ) {
+    wake_.signal();
+  }
+}
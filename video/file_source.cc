@@ -0,0 +1,188 @@
+#include "file_source.hh"
+
+#include <charconv>
+#include <cmath>
+#include <linux/videodev2.h>
+#include <ostream>
+#include <stdexcept>
+
+using namespace std;
+
+static constexpr string_view y4m_signature = "YUV4MPEG2 ";
+static constexpr string_view y4m_frame_marker = "FRAME";
+
+FileSource::FileSource( const string& filename, const bool paced, const unsigned int frame_rate )
+  : filename_( filename ), file_( filename )
+{
+  index_y4m();
+  if ( frame_rate ) {
+    frame_rate_ = frame_rate;
+  }
+  clock_.emplace( frame_rate_, paced );
+}
+
+FileSource::FileSource( const string& filename,
+                        const uint16_t width,
+                        const uint16_t height,
+                        const uint32_t pixel_format,
+                        const unsigned int frame_rate,
+                        const bool paced )
+  : filename_( filename )
+  , file_( filename )
+  , width_( width )
+  , height_( height )
+  , pixel_format_( pixel_format )
+  , frame_rate_( frame_rate )
+  , clock_( in_place, frame_rate, paced )
+{
+  index_raw();
+}
+
+void FileSource::index_raw()
+{
+  const size_t frame_size = raw_frame_size( pixel_format_, width_, height_ );
+  const string_view contents = file_;
+
+  if ( contents.size() < frame_size or contents.size() % frame_size ) {
+    throw runtime_error( filename_ + ": size " + to_string( contents.size() )
+                         + " is not a whole number of frames of " + to_string( frame_size ) + " bytes" );
+  }
+
+  for ( size_t offset = 0; offset < contents.size(); offset += frame_size ) {
+    frames_.push_back( contents.substr( offset, frame_size ) );
+  }
+}
+
+void FileSource::index_y4m()
+{
+  string_view contents = file_;
+
+  if ( not contents.starts_with( y4m_signature ) ) {
+    throw runtime_error( filename_ + ": not a Y4M file" );
+  }
+
+  const size_t header_end = contents.find( '\n' );
+  if ( header_end == string_view::npos ) {
+    throw runtime_error( filename_ + ": truncated Y4M header" );
+  }
+
+  /* parse the tagged parameters */
+  string_view params = contents.substr( y4m_signature.size(), header_end - y4m_signature.size() );
+  unsigned int rate_num = 0, rate_den = 0;
+  string_view colourspace = "420jpeg";
+
+  const auto number = [&]( string_view str, auto& out ) {
+    const auto [ptr, ec] = from_chars( str.data(), str.data() + str.size(), out );
+    if ( ec != errc {} or ptr != str.data() + str.size() ) {
+      throw runtime_error( filename_ + ": bad Y4M parameter \"" + string( str ) + "\"" );
+    }
+  };
+
+  while ( not params.empty() ) {
+    const size_t token_end = min( params.find( ' ' ), params.size() );
+    const string_view token = params.substr( 0, token_end );
+    params.remove_prefix( min( token_end + 1, params.size() ) );
+
+    if ( token.empty() ) {
+      continue;
+    }
+
+    const string_view value = token.substr( 1 );
+    switch ( token.front() ) {
+      case 'W':
+        number( value, width_ );
+        break;
+      case 'H':
+        number( value, height_ );
+        break;
+      case 'F': {
+        const size_t colon = value.find( ':' );
+        if ( colon == string_view::npos ) {
+          throw runtime_error( filename_ + ": bad Y4M frame rate" );
+        }
+        number( value.substr( 0, colon ), rate_num );
+        number( value.substr( colon + 1 ), rate_den );
+        break;
+      }
+      case 'C':
+        colourspace = value;
+        break;
+      default: /* interlacing, aspect ratio, comments: ignored */
+        break;
+    }
+  }
+
+  if ( not width_ or not height_ ) {
+    throw runtime_error( filename_ + ": Y4M header is missing the frame size" );
+  }
+
+  if ( colourspace != "420jpeg" and colourspace != "420" and colourspace != "420paldv"
+       and colourspace != "420mpeg2" ) {
+    throw runtime_error( filename_ + ": unsupported Y4M colourspace C" + string( colourspace ) );
+  }
+
+  pixel_format_ = V4L2_PIX_FMT_YUV420;
+  frame_rate_ = rate_den ? lrint( double( rate_num ) / rate_den ) : 0;
+  const size_t frame_size = raw_frame_size( pixel_format_, width_, height_ );
+
+  /* index the frames: each is "FRAME[ params]\n" followed by the planes */
+  contents.remove_prefix( header_end + 1 );
+  while ( not contents.empty() ) {
+    const size_t frame_header_end = contents.find( '\n' );
+    if ( not contents.starts_with( y4m_frame_marker ) or frame_header_end == string_view::npos
+         or contents.size() - frame_header_end - 1 < frame_size ) {
+      break; /* a truncated last frame is ignored */
+    }
+
+    frames_.push_back( contents.substr( frame_header_end + 1, frame_size ) );
+    contents.remove_prefix( frame_header_end + 1 + frame_size );
+  }
+
+  if ( frames_.empty() ) {
+    throw runtime_error( filename_ + ": no complete frames in Y4M file" );
+  }
+}
+
+void FileSource::advance( const uint64_t num_frames )
+{
+  current_frame_ += num_frames;
+  if ( current_frame_ >= frames_.size() ) {
+    loops_ += current_frame_ / frames_.size();
+    current_frame_ %= frames_.size();
+  }
+}
+
+string_view FileSource::borrow_next_frame()
+{
+  clock_->ticks();
+  if ( frames_replayed_ ) {
+    advance( 1 );
+  }
+  frames_replayed_++;
+  return frames_.at( current_frame_ );
+}
+
+string_view FileSource::borrow_most_recent_frame()
+{
+  const uint64_t ticks = max( clock_->ticks(), uint64_t( 1 ) );
+  if ( frames_replayed_ ) {
+    advance( ticks );
+  } else {
+    advance( ticks - 1 );
+  }
+  frames_skipped_ += ticks - 1;
+  frames_replayed_++;
+  return frames_.at( current_frame_ );
+}
+
+void FileSource::summary( ostream& out ) const
+{
+  out << "File source summary (" << width_ << "x" << height_ << " @ " << frame_rate_ << " fps from " << filename_
+      << ")"
+      << "\n------------------------\n\n";
+
+  out << "Frames replayed: " << frames_replayed_ << " (file has " << frames_.size() << ", looped " << loops_
+      << " times)\n";
+  out << "Frames skipped: " << frames_skipped_ << " ("
+      << nearbyint( 1000.0 * frames_skipped_ / max( 1U, frames_replayed_ + frames_skipped_ ) ) / 10.0 << "%)\n";
+}
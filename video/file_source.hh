@@ -0,0 +1,60 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "frame_clock.hh"
+#include "frame_source.hh"
+#include "mmap.hh"
+
+/* replays a raw (YUYV or I420) or Y4M file, in a loop, either paced at the
+   frame rate or as fast as the consumer can take frames */
+class FileSource : public FrameSource
+{
+  std::string filename_;
+  ReadOnlyFile file_;
+
+  uint16_t width_ {};
+  uint16_t height_ {};
+  uint32_t pixel_format_ {};
+  unsigned int frame_rate_ {};
+
+  std::vector<std::string_view> frames_ {};
+  size_t current_frame_ {};
+
+  std::optional<FrameClock> clock_ {};
+
+  void index_raw();
+  void index_y4m();
+
+  unsigned int frames_replayed_ {};
+  unsigned int frames_skipped_ {};
+  unsigned int loops_ {};
+
+  void advance( const uint64_t num_frames );
+
+public:
+  /* Y4M file: size, format and (unless overridden) frame rate come from the header */
+  FileSource( const std::string& filename, const bool paced = true, const unsigned int frame_rate = 0 );
+
+  /* raw file of back-to-back frames */
+  FileSource( const std::string& filename,
+              const uint16_t width,
+              const uint16_t height,
+              const uint32_t pixel_format,
+              const unsigned int frame_rate,
+              const bool paced = true );
+
+  uint16_t width() const override { return width_; }
+  uint16_t height() const override { return height_; }
+  uint32_t pixel_format() const override { return pixel_format_; }
+
+  FileDescriptor& fd() override { return clock_->fd(); }
+
+  std::string_view borrow_next_frame() override;
+  std::string_view borrow_most_recent_frame() override;
+  void release_frame() override {}
+
+  void summary( std::ostream& out ) const override;
+};
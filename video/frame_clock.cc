@@ -0,0 +1,29 @@
+#include "frame_clock.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+FrameClock::FrameClock( const unsigned int frame_rate, const bool paced ) : paced_( paced )
+{
+  if ( paced_ ) {
+    if ( frame_rate == 0 ) {
+      throw runtime_error( "FrameClock: paced clock needs a nonzero frame rate" );
+    }
+    const uint64_t interval = 1'000'000'000 / frame_rate;
+    timer_.set( interval, interval );
+  } else {
+    always_ready_.signal();
+  }
+}
+
+uint64_t FrameClock::ticks()
+{
+  if ( paced_ ) {
+    return timer_.read_event();
+  }
+
+  always_ready_.read_event();
+  always_ready_.signal();
+  return 1;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "eventfd.hh"
+#include "timerfd.hh"
+
+/* pacing for frame sources that don't have hardware behind them: either a periodic
+   timer at the frame rate, or (unpaced) an fd that is always readable */
+class FrameClock
+{
+  bool paced_;
+  TimerFD timer_ {};
+  EventFD always_ready_ {};
+
+public:
+  FrameClock( const unsigned int frame_rate, const bool paced );
+
+  FileDescriptor& fd() { return paced_ ? static_cast<FileDescriptor&>( timer_ ) : always_ready_; }
+
+  /* number of frame intervals that have elapsed since the last call (1 when unpaced) */
+  uint64_t ticks();
+};
@@ -0,0 +1,131 @@
+#include "frame_source.hh"
+#include "timer.hh"
+
+#include <linux/videodev2.h>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+size_t raw_frame_size( const uint32_t pixel_format, const uint16_t width, const uint16_t height )
+{
+  switch ( pixel_format ) {
+    case V4L2_PIX_FMT_YUYV:
+      return 2 * size_t( width ) * height;
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_NV12:
+      return 3 * size_t( width ) * height / 2;
+    default:
+      throw runtime_error( "raw_frame_size: unsupported pixel format " + to_string( pixel_format ) );
+  }
+}
+
+bool FramePlanes::is_420() const
+{
+  return pixel_format == V4L2_PIX_FMT_YUV420 or pixel_format == V4L2_PIX_FMT_NV12;
+}
+
+FramePlanes contiguous_planes( const string_view frame,
+                               const uint32_t pixel_format,
+                               const uint16_t width,
+                               const uint16_t height,
+                               const unsigned int stride )
+{
+  if ( frame.empty() ) {
+    return {};
+  }
+
+  FramePlanes ret { pixel_format, width, height, {}, 0 };
+  const uint8_t* base = reinterpret_cast<const uint8_t*>( frame.data() );
+  size_t needed {};
+
+  switch ( pixel_format ) {
+    case V4L2_PIX_FMT_YUYV: {
+      const unsigned int row = stride ? stride : 2 * width;
+      ret.planes[0] = { base, row };
+      ret.num_planes = 1;
+      needed = size_t( row ) * height;
+      break;
+    }
+
+    case V4L2_PIX_FMT_NV12: {
+      const unsigned int row = stride ? stride : width;
+      ret.planes[0] = { base, row };
+      ret.planes[1] = { base + size_t( row ) * height, row };
+      ret.num_planes = 2;
+      needed = size_t( row ) * height * 3 / 2;
+      break;
+    }
+
+    case V4L2_PIX_FMT_YUV420: {
+      const unsigned int row = stride ? stride : width;
+      ret.planes[0] = { base, row };
+      ret.planes[1] = { base + size_t( row ) * height, row / 2 };
+      ret.planes[2] = { ret.planes[1].data + size_t( row / 2 ) * ( height / 2 ), row / 2 };
+      ret.num_planes = 3;
+      needed = size_t( row ) * height * 3 / 2;
+      break;
+    }
+
+    default:
+      throw runtime_error( "contiguous_planes: unsupported pixel format " + to_string( pixel_format ) );
+  }
+
+  if ( frame.size() < needed ) {
+    throw runtime_error( "contiguous_planes: frame of " + to_string( frame.size() ) + " bytes is too small (need "
+                         + to_string( needed ) + ")" );
+  }
+
+  return ret;
+}
+
+FramePlanes crop_columns( const FramePlanes& frame, const uint16_t x, const uint16_t width )
+{
+  if ( frame.empty() ) {
+    return {};
+  }
+
+  if ( x % 2 or width % 2 or x + width > frame.width ) {
+    throw runtime_error( "crop_columns: invalid columns " + to_string( x ) + "+" + to_string( width ) + " of "
+                         + to_string( frame.width ) );
+  }
+
+  FramePlanes ret = frame;
+  ret.width = width;
+
+  switch ( frame.pixel_format ) {
+    case V4L2_PIX_FMT_YUYV:
+      ret.planes[0].data += 2 * x;
+      break;
+
+    case V4L2_PIX_FMT_NV12:
+      ret.planes[0].data += x;
+      ret.planes[1].data += x; /* half as many samples across, but U and V interleaved */
+      break;
+
+    case V4L2_PIX_FMT_YUV420:
+      ret.planes[0].data += x;
+      ret.planes[1].data += x / 2;
+      ret.planes[2].data += x / 2;
+      break;
+
+    default:
+      throw runtime_error( "crop_columns: unsupported pixel format " + to_string( frame.pixel_format ) );
+  }
+
+  return ret;
+}
+
+FramePlanes FrameSource::borrow_next_planes()
+{
+  FramePlanes ret = contiguous_planes( borrow_next_frame(), pixel_format(), width(), height() );
+  ret.capture_timestamp = Timer::timestamp_ns();
+  return ret;
+}
+
+FramePlanes FrameSource::borrow_most_recent_planes()
+{
+  FramePlanes ret = contiguous_planes( borrow_most_recent_frame(), pixel_format(), width(), height() );
+  ret.capture_timestamp = Timer::timestamp_ns();
+  return ret;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "file_descriptor.hh"
+#include "summarize.hh"
+
+/* a borrowed frame as pointers to its planes: one packed plane for YUYV,
+   Y + interleaved UV for NV12, or Y + U + V for I420 */
+struct FramePlanes
+{
+  struct Plane
+  {
+    const uint8_t* data {};
+    unsigned int stride {}; /* bytes per row */
+  };
+
+  uint32_t pixel_format {}; /* layout of the planes: V4L2_PIX_FMT_YUYV, _NV12 or _YUV420 */
+  uint16_t width {}, height {};
+  std::array<Plane, 3> planes {};
+  uint8_t num_planes {};
+
+  uint64_t capture_timestamp {}; /* when the frame was captured, in Timer::timestamp_ns() time; 0 if unknown */
+
+  bool empty() const { return num_planes == 0; }
+  bool is_420() const;
+};
+
+/* a source of raw video frames (a V4L2 camera, a synthetic pattern, a file being replayed...),
+   driven by an EventLoop that polls fd() */
+class FrameSource : public Summarizable
+{
+public:
+  virtual uint16_t width() const = 0;
+  virtual uint16_t height() const = 0;
+  virtual uint32_t pixel_format() const = 0; /* V4L2_PIX_FMT_* */
+
+  /* readable when a frame is ready; the borrow methods consume the readiness */
+  virtual FileDescriptor& fd() = 0;
+
+  /* the returned view is valid until release_frame(); empty on a failed frame */
+  virtual std::string_view borrow_next_frame() = 0;
+  virtual std::string_view borrow_most_recent_frame() = 0;
+  virtual void release_frame() = 0;
+
+  /* the same, per plane (the default splits up a contiguous frame, stamped with the time of the call) */
+  virtual FramePlanes borrow_next_planes();
+  virtual FramePlanes borrow_most_recent_planes();
+};
+
+/* the planes of a frame stored in one buffer with rows of `stride` bytes (0 = tightly packed) */
+FramePlanes contiguous_planes( const std::string_view frame,
+                               const uint32_t pixel_format,
+                               const uint16_t width,
+                               const uint16_t height,
+                               const unsigned int stride = 0 );
+
+/* a view of columns [x, x + width) of a frame (x and width even), sharing its buffers */
+FramePlanes crop_columns( const FramePlanes& frame, const uint16_t x, const uint16_t width );
+
+/* bytes in one frame of a (single-buffer) raw format */
+size_t raw_frame_size( const uint32_t pixel_format, const uint16_t width, const uint16_t height );
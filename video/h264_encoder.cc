@@ -1,7 +1,10 @@
 #include "h264_encoder.hh"
 #include "exception.hh"
+#include "timer.hh"
 
+#include <cmath>
 #include <iostream>
+#include <linux/videodev2.h>
 #include <x264.h>
 
 using namespace std;
@@ -11,31 +14,91 @@ H264Encoder::H264Encoder( const uint16_t width,
                           const uint8_t fps,
                           const string& preset,
                           const string& tune )
-  : width_( width ), height_( height ), fps_( fps )
+  : H264Encoder( width, height, fps, Config { preset, tune } )
+{}
+
+H264Encoder::H264Encoder( const uint16_t width, const uint16_t height, const uint8_t fps, const Config& config )
+  : width_( width ), height_( height ), fps_( fps ), config_( config ), pts_step_( PTS_RATE / fps )
 {
   if ( width_ % 2 or height_ % 2 ) {
-    throw runtime_error( "H.264 encoder requires even width and height for 4:2:0" );
+    throw runtime_error( "H.264 encoder requires even width and height" );
   }
 
+  open();
+}
+
+void H264Encoder::open()
+{
   // Set params for encoder
   x264_param_t params {};
 
-  if ( x264_param_default_preset( &params, preset.c_str(), tune.c_str() ) != 0 ) {
+  if ( x264_param_default_preset( &params, config_.preset.c_str(), config_.tune.c_str() ) != 0 ) {
     throw runtime_error( "Error: Failed to set preset on x264." );
   }
 
-  params.i_threads = 6;
+  params.i_threads = config_.threads ? config_.threads : X264_THREADS_AUTO;
+  params.i_lookahead_threads = config_.lookahead_threads ? config_.lookahead_threads : X264_THREADS_AUTO;
+  switch ( config_.threading ) {
+    case Config::Threading::Default:
+      if ( config_.slice_max_size ) {
+        params.b_sliced_threads = 1;
+      }
+      break;
+    case Config::Threading::Sliced:
+      params.b_sliced_threads = 1;
+      break;
+    case Config::Threading::Frame:
+      params.b_sliced_threads = 0;
+      break;
+  }
   params.i_width = width_;
   params.i_height = height_;
+  params.i_csp = config_.chroma_422 ? X264_CSP_I422 : X264_CSP_I420;
   params.i_fps_num = fps_;
   params.i_fps_den = 1;
+  params.b_vfr_input = 1;
+  params.i_timebase_num = 1;
+  params.i_timebase_den = PTS_RATE;
   params.b_annexb = 1;
   params.b_repeat_headers = 1;
-  params.i_keyint_max = 2 * fps_;
-  //  params.b_intra_refresh = true;
 
-  params.rc.i_qp_constant = 30;
-  params.rc.i_rc_method = X264_RC_CQP;
+  const unsigned int refresh_period = config_.refresh_period ? config_.refresh_period : 2 * fps_;
+  switch ( config_.refresh ) {
+    case Config::Refresh::PeriodicIDR:
+      params.i_keyint_max = refresh_period;
+      break;
+
+    case Config::Refresh::IntraRefresh:
+      /* with intra refresh, keyint is the length of a refresh wave rather than the distance between IDRs */
+      params.b_intra_refresh = 1;
+      params.i_keyint_max = refresh_period;
+      params.i_scenecut_threshold = 0; /* no IDRs of the encoder's own choosing */
+      break;
+
+    case Config::Refresh::OnDemandIDR:
+      params.i_keyint_max = X264_KEYINT_MAX_INFINITE;
+      params.i_scenecut_threshold = 0;
+      break;
+  }
+
+  params.i_slice_max_size = config_.slice_max_size;
+
+  switch ( config_.rate_control ) {
+    case Config::RateControl::ConstantQP:
+      params.rc.i_rc_method = X264_RC_CQP;
+      params.rc.i_qp_constant = config_.qp;
+      break;
+
+    case Config::RateControl::CappedCRF:
+      if ( config_.target_bitrate_kbps == 0 ) {
+        throw runtime_error( "H264Encoder: capped CRF needs a target bitrate" );
+      }
+      params.rc.i_rc_method = X264_RC_CRF;
+      params.rc.f_rf_constant = config_.crf;
+      params.rc.i_vbv_max_bitrate = config_.target_bitrate_kbps;
+      params.rc.i_vbv_buffer_size = vbv_buffer_kbit( config_.target_bitrate_kbps );
+      break;
+  }
 
   // Apply profile
   if ( x264_param_apply_profile( &params, "high422" ) != 0 ) {
@@ -47,36 +110,266 @@ H264Encoder::H264Encoder( const uint16_t width,
   x264_picture_init( &pic_out_ );
 }
 
-string_view H264Encoder::encode420( span<uint8_t> raster )
+void H264Encoder::set_size( const uint16_t width, const uint16_t height )
+{
+  if ( width % 2 or height % 2 ) {
+    throw runtime_error( "H.264 encoder requires even width and height" );
+  }
+
+  if ( width == width_ and height == height_ ) {
+    return;
+  }
+
+  /* x264 can't change size in place: start a new encoder, whose first picture is an IDR with new SPS/PPS */
+  width_ = width;
+  height_ = height;
+  open();
+}
+
+int H264Encoder::vbv_buffer_kbit( const unsigned int kbps ) const
+{
+  /* frame intervals at the rate frames are actually coming in at, which set_frame_rate() may have lowered */
+  return max( 1, static_cast<int>( kbps * config_.vbv_buffer_frames / frame_rate() ) );
+}
+
+void H264Encoder::set_target_bitrate( const unsigned int kbps )
+{
+  if ( config_.rate_control != Config::RateControl::CappedCRF ) {
+    throw runtime_error( "H264Encoder::set_target_bitrate() needs capped CRF rate control" );
+  }
+
+  if ( kbps == 0 ) {
+    throw runtime_error( "H264Encoder::set_target_bitrate(): bitrate must be positive" );
+  }
+
+  if ( kbps == config_.target_bitrate_kbps ) {
+    return;
+  }
+
+  x264_param_t params;
+  x264_encoder_parameters( encoder_.get(), &params );
+  params.rc.i_vbv_max_bitrate = kbps;
+  params.rc.i_vbv_buffer_size = vbv_buffer_kbit( kbps );
+
+  if ( x264_encoder_reconfig( encoder_.get(), &params ) < 0 ) {
+    throw runtime_error( "x264_encoder_reconfig failed to set bitrate to " + to_string( kbps ) + " kbps" );
+  }
+
+  config_.target_bitrate_kbps = kbps;
+}
+
+void H264Encoder::recover( const optional<int64_t> first_lost_pts )
+{
+  recovery_pts_ = next_pts_;
+
+  if ( config_.refresh == Config::Refresh::IntraRefresh ) {
+    /* x264 refuses to invalidate references with intra refresh on: start a new wave, which cleans the
+       picture up within a refresh period without an IDR */
+    x264_encoder_intra_refresh( encoder_.get() );
+    return;
+  }
+
+  /* x264 also refuses with B-frames (and there's nothing to go on without a pts): those get an IDR */
+  x264_param_t params;
+  x264_encoder_parameters( encoder_.get(), &params );
+  if ( first_lost_pts.has_value() and params.i_bframe == 0
+       and x264_encoder_invalidate_reference( encoder_.get(), first_lost_pts.value() ) == 0 ) {
+    return;
+  }
+
+  request_keyframe();
+}
+
+void H264Encoder::set_frame_rate( const double fps )
+{
+  if ( not( fps > 0 ) ) {
+    throw runtime_error( "H264Encoder::set_frame_rate(): frame rate must be positive" );
+  }
+
+  const int64_t pts_step = max( int64_t( 1 ), int64_t( llround( PTS_RATE / fps ) ) );
+  if ( pts_step == pts_step_ ) {
+    return;
+  }
+
+  pts_step_ = pts_step;
+
+  /* the VBV holds a number of frame intervals, which have just changed length */
+  if ( config_.rate_control == Config::RateControl::CappedCRF ) {
+    x264_param_t params;
+    x264_encoder_parameters( encoder_.get(), &params );
+    params.rc.i_vbv_buffer_size = vbv_buffer_kbit( config_.target_bitrate_kbps );
+
+    if ( x264_encoder_reconfig( encoder_.get(), &params ) < 0 ) {
+      throw runtime_error( "x264_encoder_reconfig failed to resize the VBV for " + to_string( fps ) + " fps" );
+    }
+  }
+}
+
+const EncodedFrame& H264Encoder::encode420( span<uint8_t> raster )
 {
   if ( 3 * width_ * height_ / 2 != raster.size() ) {
     throw runtime_error( "H264Encoder::encode420(): size mismatch. Expected "
                          + to_string( 3 * width_ * height_ / 2 ) + " but got " + to_string( raster.size() ) );
   }
 
-  pic_in_.img.i_csp = X264_CSP_I420;
-  pic_in_.img.i_plane = 3;
+  return encode420( contiguous_planes(
+    { reinterpret_cast<const char*>( raster.data() ), raster.size() }, V4L2_PIX_FMT_YUV420, width_, height_ ) );
+}
+
+const EncodedFrame& H264Encoder::encode420( const FramePlanes& frame )
+{
+  if ( not frame.is_420() ) {
+    throw runtime_error( "H264Encoder::encode420(): frame is not 4:2:0" );
+  }
+
+  return encode( frame );
+}
+
+const EncodedFrame& H264Encoder::encode422( const FramePlanes& frame )
+{
+  if ( frame.pixel_format != V4L2_PIX_FMT_YUYV ) {
+    throw runtime_error( "H264Encoder::encode422(): frame is not YUYV" );
+  }
+
+  return encode( frame );
+}
+
+const EncodedFrame& H264Encoder::encode( const FramePlanes& frame )
+{
+  if ( frame.width != width_ or frame.height != height_ ) {
+    throw runtime_error( "H264Encoder::encode(): frame is " + to_string( frame.width ) + "x"
+                         + to_string( frame.height ) + ", expected " + to_string( width_ ) + "x"
+                         + to_string( height_ ) );
+  }
+
+  /* the input has to match the family of the encoder's chroma format */
+  const bool frame_is_422 = frame.pixel_format == V4L2_PIX_FMT_YUYV;
+  if ( frame_is_422 != config_.chroma_422 ) {
+    throw runtime_error( string( "H264Encoder::encode(): " ) + ( frame_is_422 ? "4:2:2" : "4:2:0" )
+                         + " frame given to a " + ( config_.chroma_422 ? "4:2:2" : "4:2:0" ) + " encoder" );
+  }
+
+  switch ( frame.pixel_format ) {
+    case V4L2_PIX_FMT_YUV420:
+      pic_in_.img.i_csp = X264_CSP_I420;
+      break;
+    case V4L2_PIX_FMT_NV12:
+      pic_in_.img.i_csp = X264_CSP_NV12;
+      break;
+    case V4L2_PIX_FMT_YUYV:
+      pic_in_.img.i_csp = X264_CSP_YUYV;
+      break;
+    default:
+      throw runtime_error( "H264Encoder::encode(): unsupported pixel format" );
+  }
 
-  pic_in_.img.i_stride[0] = width_;
-  pic_in_.img.i_stride[1] = width_ / 2;
-  pic_in_.img.i_stride[2] = width_ / 2;
+  pic_in_.i_pts = next_pts_;
+  next_pts_ += pts_step_;
+  pic_in_.i_type = keyframe_requested_ ? X264_TYPE_IDR : X264_TYPE_AUTO;
+  keyframe_requested_ = false;
+  pending_frames_[frames_submitted_++ % pending_frames_.size()]
+    = { pic_in_.i_pts, frame.capture_timestamp ? frame.capture_timestamp : Timer::timestamp_ns() };
 
-  pic_in_.img.plane[0] = raster.data();
-  pic_in_.img.plane[1] = raster.data() + width_ * height_;
-  pic_in_.img.plane[2] = raster.data() + width_ * height_ + ( width_ / 2 ) * ( height_ / 2 );
+  /* x264 only reads from the input planes */
+  pic_in_.img.i_plane = frame.num_planes;
+  for ( unsigned int i = 0; i < frame.num_planes; i++ ) {
+    pic_in_.img.i_stride[i] = frame.planes.at( i ).stride;
+    pic_in_.img.plane[i] = const_cast<uint8_t*>( frame.planes.at( i ).data );
+  }
 
+  return encode_picture();
+}
+
+const EncodedFrame& H264Encoder::encode_picture()
+{
   int nals_count = 0;
   x264_nal_t* nal;
 
+  const uint64_t start = Timer::timestamp_ns();
   const auto frame_size = x264_encoder_encode( encoder_.get(), &nal, &nals_count, &pic_in_, &pic_out_ );
 
   if ( frame_size < 0 ) {
     throw runtime_error( "x264_encoder_encode returned error" );
   }
 
+  /* let go of the last output first, so its buffer can be reused if nobody else kept it */
+  output_.payload = {};
+  output_.nals.clear();
+  output_.storage = {};
+  output_.encode_duration = Timer::timestamp_ns() - start;
+
   if ( not nal or frame_size <= 0 ) {
-    return {};
+    return output_;
+  }
+
+  /* x264 lays the NALs out back to back, in memory it reuses: the one copy, into a pooled buffer */
+  const char* x264_payload = reinterpret_cast<const char*>( nal->p_payload );
+  output_.storage = output_pool_->take( { x264_payload, static_cast<size_t>( frame_size ) } );
+  output_.payload = output_.storage.view();
+  for ( const x264_nal_t& n : span( nal, nals_count ) ) {
+    output_.nals.push_back( { static_cast<uint8_t>( n.i_type ),
+                              static_cast<uint8_t>( n.i_ref_idc ),
+                              output_.payload.substr( reinterpret_cast<const char*>( n.p_payload ) - x264_payload,
+                                                      n.i_payload ) } );
+  }
+
+  output_.pts = pic_out_.i_pts;
+  /* not b_keyframe: x264 sets that on an intra refresh's recovery point too, which still refers to earlier
+     frames */
+  output_.keyframe = pic_out_.i_type == X264_TYPE_IDR;
+  output_.recovery = recovery_pts_.has_value() and pic_out_.i_pts >= recovery_pts_.value();
+  if ( output_.recovery ) {
+    recovery_pts_.reset();
+  }
+  output_.capture_timestamp = 0;
+  for ( const auto& pending : pending_frames_ ) {
+    if ( pending.pts == pic_out_.i_pts ) {
+      output_.capture_timestamp = pending.capture_timestamp;
+      break;
+    }
   }
 
-  return { reinterpret_cast<char*>( nal->p_payload ), static_cast<size_t>( frame_size ) };
+  return output_;
+}
+
+uint8_t EncodedFrame::importance() const
+{
+  uint8_t ret = 0;
+  for ( const auto& nal : nals ) {
+    ret = max( ret, nal.ref_idc );
+  }
+  return ret;
+}
+
+vector<string_view> EncodedFrame::slices() const
+{
+  vector<string_view> ret;
+  slices( ret );
+  return ret;
+}
+
+void EncodedFrame::slices( vector<string_view>& ret ) const
+{
+  ret.clear();
+  const char* start = nullptr;
+
+  for ( const auto& nal : nals ) {
+    if ( not start ) {
+      start = nal.payload.data();
+    }
+
+    if ( nal.type == NAL_SLICE or nal.type == NAL_SLICE_IDR ) {
+      ret.emplace_back( start, nal.payload.data() + nal.payload.size() );
+      start = nullptr;
+    }
+  }
+
+  /* anything after the last slice stays with it */
+  if ( start ) {
+    if ( ret.empty() ) {
+      ret.emplace_back( payload );
+    } else {
+      ret.back() = { ret.back().data(), payload.data() + payload.size() };
+    }
+  }
 }
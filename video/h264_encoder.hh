@@ -1,14 +1,115 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <x264.h>
 
+#include "buffer_pool.hh"
+#include "frame_source.hh"
+
+/* one picture of encoder output: its NAL units back to back (Annex B), plus what each of them is.
+   The views point into `storage`, a buffer from the encoder's pool: valid until the encoder's next encode
+   call, or for as long as a copy of `storage` is kept. */
+struct EncodedFrame
+{
+  struct NAL
+  {
+    uint8_t type {};    /* nal_unit_type: NAL_SLICE, NAL_SLICE_IDR, NAL_SPS, NAL_PPS, NAL_SEI... */
+    uint8_t ref_idc {}; /* nal_ref_idc: NAL_PRIORITY_DISPOSABLE (0) to NAL_PRIORITY_HIGHEST (3) */
+    std::string_view payload {}; /* including the start code */
+  };
+
+  std::string_view payload {}; /* every NAL */
+  std::vector<NAL> nals {};
+  PooledBuffer storage {};
+
+  int64_t pts {};
+  bool keyframe {};              /* IDR: decodable without any earlier frame */
+  bool recovery {};              /* the first picture coded after H264Encoder::recover() */
+  uint64_t capture_timestamp {}; /* of the input picture, as in FramePlanes */
+  uint64_t encode_duration {};   /* ns spent in x264_encoder_encode */
+
+  bool empty() const { return payload.empty(); }
+  size_t size() const { return payload.size(); }
+
+  /* highest nal_ref_idc among the NALs: how much later frames depend on this one */
+  uint8_t importance() const;
+
+  /* the frame cut into independently decodable pieces: each slice, with any parameter sets or SEI that
+     come ahead of it */
+  std::vector<std::string_view> slices() const;
+  void slices( std::vector<std::string_view>& out ) const; /* reusing out's capacity */
+};
+
 class H264Encoder
 {
+public:
+  struct Config
+  {
+    std::string preset { "veryfast" };
+    std::string tune { "zerolatency" }; /* "" for none */
+
+    /* Sliced: each picture is cut into slices coded in parallel, adding no delay. Frame: whole pictures are
+       coded in parallel, adding a picture of delay per thread. Default: as the preset and tune have it
+       (sliced with zerolatency), or sliced if slice_max_size is set. */
+    enum class Threading
+    {
+      Default,
+      Sliced,
+      Frame
+    };
+
+    Threading threading { Threading::Default };
+    unsigned int threads { 0 };           /* 0: x264 picks from the number of cores */
+    unsigned int lookahead_threads { 0 }; /* 0: x264 picks */
+
+    /* encode 4:2:2, so packed YUYV frames can go to x264 as they are (encode422)
+       instead of being converted to 4:2:0 first */
+    bool chroma_422 { false };
+
+    /* ConstantQP: the bitrate follows scene complexity. CappedCRF: constant quality, but capped by a
+       VBV at target_bitrate_kbps, which set_target_bitrate() can move while encoding. */
+    enum class RateControl
+    {
+      ConstantQP,
+      CappedCRF
+    };
+
+    RateControl rate_control { RateControl::ConstantQP };
+    int qp { 30 };
+    float crf { 23 };
+    unsigned int target_bitrate_kbps { 4000 };
+    /* VBV size in frame intervals (at the current frame rate) at the target rate (smaller = less delay) */
+    float vbv_buffer_frames { 1 };
+
+    /* if nonzero, end each slice before it passes this many bytes (start code and NAL header included).
+       Sized to a whole number of network chunks, each slice travels as its own decodable NAL, and a lost
+       packet only holds up the slice it belongs to. */
+    unsigned int slice_max_size { 0 };
+
+    /* how the stream recovers. PeriodicIDR: an IDR every refresh_period frames. IntraRefresh: a column of
+       intra macroblocks sweeps across the picture once per refresh_period frames, so the bits a keyframe
+       would take come evenly spread over many frames. OnDemandIDR: no refresh at all. In the last two,
+       the only IDRs are the first frame and those asked for with request_keyframe(). */
+    enum class Refresh
+    {
+      PeriodicIDR,
+      IntraRefresh,
+      OnDemandIDR
+    };
+
+    Refresh refresh { Refresh::PeriodicIDR };
+    unsigned int refresh_period { 0 }; /* in frames; 0: 2 * fps */
+  };
+
+private:
   struct x264_deleter
   {
     void operator()( x264_t* x ) const { x264_encoder_close( x ); }
@@ -21,6 +122,35 @@ class H264Encoder
   uint16_t width_;
   uint16_t height_;
   uint8_t fps_;
+  Config config_;
+
+  /* timestamps are in 1/PTS_RATE s, and each frame advances them by one interval at the current frame rate
+     (which x264's rate control follows) */
+  static constexpr int64_t PTS_RATE = 90'000;
+  int64_t pts_step_;
+  int64_t next_pts_ {};
+
+  /* capture timestamps of the frames inside the encoder */
+  struct PendingFrame
+  {
+    int64_t pts;
+    uint64_t capture_timestamp;
+  };
+  std::array<PendingFrame, 64> pending_frames_ {};
+  uint64_t frames_submitted_ {};
+
+  EncodedFrame output_ {};
+  std::shared_ptr<BufferPool> output_pool_ { BufferPool::make() }; /* x264 reuses its own output memory */
+
+  bool keyframe_requested_ {};
+  std::optional<int64_t> recovery_pts_ {}; /* of the first picture given to the encoder after recover() */
+
+  int vbv_buffer_kbit( const unsigned int kbps ) const;
+
+  /* (re)start x264 with the current size and config */
+  void open();
+
+  const EncodedFrame& encode_picture();
 
 public:
   H264Encoder( const uint16_t width,
@@ -29,5 +159,49 @@ public:
                const std::string& preset,
                const std::string& tune );
 
-  std::string_view encode420( std::span<uint8_t> raster );
+  H264Encoder( const uint16_t width, const uint16_t height, const uint8_t fps, const Config& config );
+
+  /* each returns the output for one picture (empty if the encoder is still holding it) */
+  const EncodedFrame& encode420( std::span<uint8_t> raster );
+
+  /* encode a 4:2:0 frame (I420 or NV12) in place, e.g. straight out of the camera's buffers */
+  const EncodedFrame& encode420( const FramePlanes& frame );
+
+  /* encode a packed YUYV frame in place (needs Config::chroma_422) */
+  const EncodedFrame& encode422( const FramePlanes& frame );
+
+  /* encode whatever layout the frame has, if the encoder's chroma format can take it */
+  const EncodedFrame& encode( const FramePlanes& frame );
+
+  bool chroma_422() const { return config_.chroma_422; }
+
+  /* make the next picture an IDR, whatever the refresh mode */
+  void request_keyframe() { keyframe_requested_ = true; }
+
+  /* the receiver lost the picture with this pts and can't use anything since. In IntraRefresh mode,
+     start a new refresh wave. Otherwise, stop referring to those pictures if x264 still has older ones to
+     use (only possible without B-frames), or else send an IDR. An empty optional (loss too far back to
+     say) gets an IDR, outside IntraRefresh mode. */
+  void recover( const std::optional<int64_t> first_lost_pts );
+
+  /* change the picture size while encoding (e.g. to fit a congested path). The stream goes on, with the
+     same timestamps, from an IDR with new parameter sets; pictures the old encoder still held are lost. */
+  void set_size( const uint16_t width, const uint16_t height );
+  uint16_t width() const { return width_; }
+  uint16_t height() const { return height_; }
+
+  /* move the VBV cap (CappedCRF only), effective from the next frame without restarting the encoder: e.g. to
+     each target VideoClient's bitrate handler is given */
+  void set_target_bitrate( const unsigned int kbps );
+
+  /* the rate frames are actually being given to the encoder at, if fewer than the nominal fps (e.g. when
+     skipping frames under overload), so the rate control spreads the bitrate over the frames that exist.
+     With CappedCRF, the VBV is resized to keep vbv_buffer_frames intervals. */
+  void set_frame_rate( const double fps );
+  double frame_rate() const { return double( PTS_RATE ) / pts_step_; }
+
+  /* a frame interval passes with no picture (e.g. skipped as unchanged): the next picture's timestamp
+     shows the gap, so the rate control can spend the bits the skipped one didn't use */
+  void skip_frame() { next_pts_ += pts_step_; }
+  unsigned int target_bitrate_kbps() const { return config_.target_bitrate_kbps; }
 };
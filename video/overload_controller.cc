@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+#include "overload_controller.hh"
+#include "timer.hh"
+
+using namespace std;
+
+OverloadController::OverloadController() : OverloadController( Config {} ) {}
+
+OverloadController::OverloadController( const Config& config ) : config_( config ), fps_( config.max_fps )
+{
+  if ( not( config_.min_fps > 0 ) or config_.min_fps > config_.max_fps ) {
+    throw runtime_error( "OverloadController: invalid frame rate range" );
+  }
+
+  if ( config_.headroom >= config_.budget or config_.step_up <= 1 ) {
+    throw runtime_error( "OverloadController: headroom must be below budget, and step_up above 1" );
+  }
+}
+
+bool OverloadController::admit()
+{
+  credit_ += fps_ / config_.max_fps;
+  if ( credit_ >= 1 ) {
+    credit_ -= 1;
+    frames_admitted_++;
+    return true;
+  }
+
+  frames_skipped_++;
+  return false;
+}
+
+optional<double> OverloadController::record_encode( const uint64_t encode_duration_ns, const uint64_t now )
+{
+  if ( smoothed_encode_ns_ == 0 ) {
+    smoothed_encode_ns_ = encode_duration_ns;
+  } else {
+    smoothed_encode_ns_ += config_.smoothing * ( encode_duration_ns - smoothed_encode_ns_ );
+  }
+
+  /* over budget: down to a rate where encoding takes a share of the interval halfway between headroom and
+     budget, so that noise in the encode time doesn't tip it straight back out */
+  if ( smoothed_encode_ns_ > config_.budget * interval_ns( fps_ ) ) {
+    headroom_since_.reset();
+
+    const double fitting_fps = ( config_.budget + config_.headroom ) / 2 * 1e9 / smoothed_encode_ns_;
+    const double next = clamp( fitting_fps, config_.min_fps, config_.max_fps );
+    if ( next >= fps_ ) {
+      return {}; /* already as low as it goes */
+    }
+
+    fps_ = next;
+    decreases_++;
+    return fps_;
+  }
+
+  if ( fps_ >= config_.max_fps ) {
+    return {};
+  }
+
+  /* headroom even at the next rate up: once it has lasted, go there */
+  const double next = min( fps_ * config_.step_up, config_.max_fps );
+  if ( smoothed_encode_ns_ > config_.headroom * interval_ns( next ) ) {
+    headroom_since_.reset();
+    return {};
+  }
+
+  if ( not headroom_since_.has_value() ) {
+    headroom_since_ = now;
+  }
+
+  if ( now < headroom_since_.value() + config_.hold_ns ) {
+    return {};
+  }
+
+  headroom_since_.reset();
+  fps_ = next;
+  increases_++;
+  return fps_;
+}
+
+void OverloadController::summary( ostream& out ) const
+{
+  out << "Overload controller: fps=" << fixed << setprecision( 1 ) << fps_ << "/" << config_.max_fps;
+  out << " encode time=";
+  Timer::pp_ns( out, smoothed_encode_ns_ );
+  out << " (budget ";
+  Timer::pp_ns( out, config_.budget * interval_ns( fps_ ) );
+  out << ") admitted/skipped=" << frames_admitted_ << "/" << frames_skipped_;
+  out << " decreases/increases=" << decreases_ << "/" << increases_ << "\n";
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+#include "summarize.hh"
+
+/* keeps the encoder within its time budget: when the (smoothed) encode time no longer fits in the frame
+   interval, lower the frame rate to one it does fit, by encoding an evenly spread subset of the captured
+   frames; once there is headroom again for a while, step back up towards the capture rate */
+class OverloadController : public Summarizable
+{
+public:
+  struct Config
+  {
+    double max_fps { 30 }; /* the capture rate */
+    double min_fps { 5 };
+
+    float budget { 0.9 };   /* slow down when encoding takes more than this share of the frame interval */
+    float headroom { 0.6 }; /* speed up when encoding would take less than this share at the higher rate... */
+    uint64_t hold_ns { 1'000'000'000 }; /* ...and has for this long */
+
+    float step_up { 1.2 };   /* frame rate multiplier when speeding up */
+    float smoothing { 0.1 }; /* weight of each new encode time in the moving average */
+  };
+
+private:
+  Config config_;
+  double fps_;
+
+  double smoothed_encode_ns_ {};
+  float credit_ {}; /* frames' worth of encoding owed, at fps_ / max_fps per captured frame */
+  std::optional<uint64_t> headroom_since_ {};
+
+  unsigned int frames_admitted_ {}, frames_skipped_ {}, decreases_ {}, increases_ {};
+
+  double interval_ns( const double fps ) const { return 1e9 / fps; }
+
+public:
+  OverloadController();
+  explicit OverloadController( const Config& config );
+
+  /* for each captured frame: encode it, or skip it to keep to the current rate? */
+  bool admit();
+
+  /* after each encode; returns the new frame rate if it changed (to pass to H264Encoder::set_frame_rate) */
+  std::optional<double> record_encode( const uint64_t encode_duration_ns, const uint64_t now );
+
+  double frame_rate() const { return fps_; }
+
+  void summary( std::ostream& out ) const override;
+};
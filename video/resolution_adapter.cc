@@ -0,0 +1,84 @@
+#include <stdexcept>
+
+#include "resolution_adapter.hh"
+
+using namespace std;
+
+ResolutionAdapter::ResolutionAdapter( const uint16_t width, const uint16_t height, const double fps )
+  : ResolutionAdapter( width, height, fps, Config {} )
+{}
+
+ResolutionAdapter::ResolutionAdapter( const uint16_t width,
+                                      const uint16_t height,
+                                      const double fps,
+                                      const Config& config )
+  : config_( config ), width_( width ), height_( height ), fps_( fps )
+{
+  if ( config_.divisors.empty() or config_.up_margin < 1 ) {
+    throw runtime_error( "ResolutionAdapter: need at least one size, and an up_margin of at least 1" );
+  }
+
+  for ( unsigned int i = 0; i < config_.divisors.size(); i++ ) {
+    if ( config_.divisors[i] == 0 or ( i > 0 and config_.divisors[i] <= config_.divisors[i - 1] ) ) {
+      throw runtime_error( "ResolutionAdapter: divisors must go up from the largest size" );
+    }
+
+    if ( size( i ).width == 0 or size( i ).height == 0 ) {
+      throw runtime_error( "ResolutionAdapter: 1/" + to_string( config_.divisors[i] ) + " size is too small" );
+    }
+  }
+}
+
+ResolutionAdapter::Size ResolutionAdapter::size( const unsigned int level ) const
+{
+  /* rounded down to even sizes, for 4:2:0 */
+  const unsigned int divisor = config_.divisors.at( level );
+  return { static_cast<uint16_t>( width_ / divisor & ~1 ), static_cast<uint16_t>( height_ / divisor & ~1 ) };
+}
+
+double ResolutionAdapter::needed_kbps( const unsigned int level ) const
+{
+  const Size s = size( level );
+  return config_.min_bits_per_pixel * s.width * s.height * fps_ / 1000;
+}
+
+optional<ResolutionAdapter::Size> ResolutionAdapter::update( const unsigned int target_kbps, const uint64_t now )
+{
+  target_kbps_ = target_kbps;
+
+  const bool too_big = level_ + 1 < config_.divisors.size() and target_kbps < needed_kbps( level_ );
+  const bool room_to_grow = level_ > 0 and target_kbps >= config_.up_margin * needed_kbps( level_ - 1 );
+
+  if ( not too_big and not room_to_grow ) {
+    condition_since_.reset();
+    return {};
+  }
+
+  if ( not condition_since_.has_value() or room_to_grow != stepping_up_ ) {
+    condition_since_ = now;
+    stepping_up_ = room_to_grow;
+  }
+
+  if ( now < condition_since_.value() + config_.hold_ns ) {
+    return {};
+  }
+
+  condition_since_.reset();
+  if ( too_big ) {
+    level_++;
+    decreases_++;
+  } else {
+    level_--;
+    increases_++;
+  }
+
+  return size( level_ );
+}
+
+void ResolutionAdapter::summary( ostream& out ) const
+{
+  const Size s = size( level_ );
+  out << "Resolution adapter: " << s.width << "x" << s.height << " (needs "
+      << static_cast<unsigned int>( needed_kbps( level_ ) ) << " kbps, target " << target_kbps_ << " kbps)";
+  out << " decreases/increases=" << decreases_ << "/" << increases_ << "\n";
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#include "summarize.hh"
+
+/* picks the picture size when the bitrate alone can't fit the path: if the target bitrate (e.g. as given to
+   VideoClient's bitrate handler) stays below what the current size needs, step down to a smaller one; once
+   it stays well above what the next size up needs, step back up. The switch is the encoder's business
+   (ColorspaceConverter::set_output_size, H264Encoder::set_size): the connection and its NAL numbering carry
+   on. */
+class ResolutionAdapter : public Summarizable
+{
+public:
+  struct Config
+  {
+    std::vector<unsigned int> divisors { 1, 2 }; /* of the capture's width and height, largest size first */
+
+    float min_bits_per_pixel { 0.02 }; /* a size needs at least this much, per pixel per frame */
+    float up_margin { 1.5 };           /* step up once the target is this much over what the size needs */
+    uint64_t hold_ns { 3'000'000'000 }; /* ...as long as it has been, continuously, for this long */
+  };
+
+  struct Size
+  {
+    uint16_t width, height;
+  };
+
+private:
+  Config config_;
+  uint16_t width_, height_;
+  double fps_;
+
+  unsigned int level_ {}; /* index into divisors */
+  std::optional<uint64_t> condition_since_ {}; /* of too low a target to keep the size, or high enough to grow */
+  bool stepping_up_ {};
+  unsigned int target_kbps_ {}, decreases_ {}, increases_ {};
+
+  Size size( const unsigned int level ) const;
+  double needed_kbps( const unsigned int level ) const;
+
+public:
+  ResolutionAdapter( const uint16_t width, const uint16_t height, const double fps );
+  ResolutionAdapter( const uint16_t width, const uint16_t height, const double fps, const Config& config );
+
+  /* feed the current target bitrate; returns the new size if it should change */
+  std::optional<Size> update( const unsigned int target_kbps, const uint64_t now );
+
+  Size current_size() const { return size( level_ ); }
+
+  void summary( std::ostream& out ) const override;
+};
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <linux/videodev2.h>
 #include <span>
 
 #include "exception.hh"
@@ -6,42 +7,164 @@
 
 using namespace std;
 
+static AVPixelFormat av_pixel_format( const uint32_t pixel_format )
+{
+  switch ( pixel_format ) {
+    case V4L2_PIX_FMT_YUYV:
+      return AV_PIX_FMT_YUYV422;
+    case V4L2_PIX_FMT_YUV420:
+      return AV_PIX_FMT_YUV420P;
+    case V4L2_PIX_FMT_NV12:
+      return AV_PIX_FMT_NV12;
+    default:
+      throw runtime_error( "ColorspaceConverter: unsupported pixel format " + to_string( pixel_format ) );
+  }
+}
+
 ColorspaceConverter::ColorspaceConverter( const uint16_t width, const uint16_t height )
-  : width_( width )
+  : ColorspaceConverter( width, height, Config {} )
+{}
+
+ColorspaceConverter::ColorspaceConverter( const uint16_t width, const uint16_t height, const Config& config )
+  : config_( config )
+  , width_( width )
   , height_( height )
-  , context_( notnull( "sws_getContext YUYV 4:2:2 => YUV 4:2:0 planar",
-                       sws_getContext( width,
-                                       height,
-                                       AV_PIX_FMT_YUYV422,
-                                       width,
-                                       height,
-                                       AV_PIX_FMT_YUV420P,
-                                       SWS_FAST_BILINEAR,
-                                       nullptr,
-                                       nullptr,
-                                       nullptr ) ) )
+  , source_format_( config.source_format )
+  , output_width_( config.output_width ? config.output_width : width )
+  , output_height_( config.output_height ? config.output_height : height )
 {
-  if ( width_ % 2 or height_ % 2 ) {
+  if ( width_ % 2 or height_ % 2 or output_width_ % 2 or output_height_ % 2 ) {
     throw runtime_error( "Conversion to 4:2:0 needs even width and height" );
   }
+
+  if ( config.num_threads == 0 ) {
+    throw runtime_error( "ColorspaceConverter needs at least one thread" );
+  }
+
+  configure();
 }
 
-void ColorspaceConverter::convert( string_view yuv422, span<uint8_t> yuv420p ) const
+void ColorspaceConverter::set_output_size( const uint16_t width, const uint16_t height )
 {
-  const array<const uint8_t*, 1> source_planes { reinterpret_cast<const uint8_t*>( yuv422.data() ) };
-  const array<const int, 1> source_strides { width_ * 2 };
+  if ( width % 2 or height % 2 ) {
+    throw runtime_error( "Conversion to 4:2:0 needs even width and height" );
+  }
+
+  if ( width == output_width_ and height == output_height_ ) {
+    return;
+  }
+
+  output_width_ = width;
+  output_height_ = height;
+  configure();
+}
+
+void ColorspaceConverter::configure()
+{
+  const bool scaling = output_width_ != width_ or output_height_ != height_;
+  kernel_.reset();
+  if ( not config_.force_swscale and not scaling and source_format_ == V4L2_PIX_FMT_YUYV ) {
+    kernel_ = YUYVToI420::best_kernel();
+  }
+
+  /* split the row pairs as evenly as possible (scaling filters across rows, so it takes the frame whole) */
+  bands_.clear();
+  const unsigned int row_pairs = height_ / 2;
+  const unsigned int num_bands = scaling ? 1 : min( config_.num_threads, row_pairs );
+  for ( unsigned int i = 0; i < num_bands; i++ ) {
+    const unsigned int first_pair = i * row_pairs / num_bands;
+    const unsigned int end_pair = ( i + 1 ) * row_pairs / num_bands;
+    Band& band = bands_.emplace_back( Band {
+      static_cast<uint16_t>( 2 * first_pair ), static_cast<uint16_t>( 2 * ( end_pair - first_pair ) ), {} } );
+
+    if ( not kernel_.has_value() ) {
+      band.context.reset( notnull( "sws_getContext => YUV 4:2:0 planar",
+                                   sws_getContext( width_,
+                                                   band.num_rows,
+                                                   av_pixel_format( source_format_ ),
+                                                   output_width_,
+                                                   band.num_rows * output_height_ / height_,
+                                                   AV_PIX_FMT_YUV420P,
+                                                   scaling ? SWS_AREA : SWS_FAST_BILINEAR,
+                                                   nullptr,
+                                                   nullptr,
+                                                   nullptr ) ) );
+    }
+  }
+
+  if ( bands_.size() == 1 ) {
+    pool_.reset();
+  } else if ( not pool_ or pool_->num_threads() != bands_.size() ) {
+    pool_ = make_unique<WorkerPool>( bands_.size() );
+  }
+}
+
+void ColorspaceConverter::convert( string_view source, span<uint8_t> yuv420p ) const
+{
+  convert( contiguous_planes( source, source_format_, width_, height_ ), yuv420p );
+}
+
+FramePlanes ColorspaceConverter::convert( const FramePlanes& source, span<uint8_t> yuv420p ) const
+{
+  if ( source.pixel_format != source_format_ or source.width != width_ or source.height != height_ ) {
+    throw runtime_error( "ColorspaceConverter: expected a " + to_string( width_ ) + "x" + to_string( height_ )
+                         + " frame in format " + to_string( source_format_ ) );
+  }
+
+  if ( yuv420p.size() < output_size() ) {
+    throw runtime_error( "ColorspaceConverter: output buffer too small" );
+  }
+
+  if ( pool_ ) {
+    pool_->run( bands_.size(), [&]( const unsigned int i ) { convert_band( bands_[i], source, yuv420p ); } );
+  } else {
+    convert_band( bands_.front(), source, yuv420p );
+  }
+
+  FramePlanes ret = contiguous_planes( { reinterpret_cast<const char*>( yuv420p.data() ), yuv420p.size() },
+                                       V4L2_PIX_FMT_YUV420,
+                                       output_width_,
+                                       output_height_ );
+  ret.capture_timestamp = source.capture_timestamp;
+  return ret;
+}
+
+void ColorspaceConverter::convert_band( const Band& band, const FramePlanes& source, span<uint8_t> yuv420p ) const
+{
+  /* bands are only split when not scaling, so the band's output rows are its input rows */
+  const unsigned int chroma_width = output_width_ / 2;
+  uint8_t* y = yuv420p.data() + size_t( band.first_row ) * output_width_;
+  uint8_t* u = yuv420p.data() + output_width_ * output_height_ + size_t( band.first_row / 2 ) * chroma_width;
+  uint8_t* v = u + chroma_width * ( output_height_ / 2 );
+
+  if ( kernel_.has_value() ) {
+    YUYVToI420::convert( kernel_.value(),
+                         source.planes[0].data + size_t( band.first_row ) * source.planes[0].stride,
+                         source.planes[0].stride,
+                         { y, u, v, output_width_, chroma_width, chroma_width },
+                         width_,
+                         band.num_rows );
+    return;
+  }
+
+  /* a 4:2:0 source's chroma planes have half as many rows */
+  array<const uint8_t*, 3> source_planes {};
+  array<int, 3> source_strides {};
+  for ( unsigned int i = 0; i < source.num_planes; i++ ) {
+    const unsigned int first_row = ( i == 0 ) ? band.first_row : band.first_row / 2;
+    source_planes[i] = source.planes[i].data + size_t( first_row ) * source.planes[i].stride;
+    source_strides[i] = source.planes[i].stride;
+  }
 
-  const array<uint8_t*, 3> dest_planes { yuv420p.data(),
-                                         yuv420p.data() + width_ * height_,
-                                         yuv420p.data() + width_ * height_ + ( width_ / 2 ) * ( height_ / 2 ) };
-  const array<const int, 3> dest_strides { width_, width_ / 2, width_ / 2 };
+  const array<uint8_t*, 3> dest_planes { y, u, v };
+  const array<const int, 3> dest_strides { output_width_, output_width_ / 2, output_width_ / 2 };
 
-  if ( height_
-       != sws_scale( context_.get(),
+  if ( int( band.num_rows * output_height_ / height_ )
+       != sws_scale( band.context.get(),
                      source_planes.data(),
                      source_strides.data(),
                      0,
-                     height_,
+                     band.num_rows,
                      dest_planes.data(),
                      dest_strides.data() ) ) {
     throw runtime_error( "unexpected return value from sws_scale" );
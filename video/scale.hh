@@ -1,25 +1,77 @@
 #pragma once
 
+#include <linux/videodev2.h>
 #include <memory>
+#include <optional>
 #include <span>
+#include <vector>
+
+#include "frame_source.hh"
+#include "worker_pool.hh"
+#include "yuyv_to_i420.hh"
 
 extern "C" {
 #include "libswscale/swscale.h"
 }
 
+/* converts frames to planar 4:2:0 (I420), optionally scaling them too */
 class ColorspaceConverter
 {
+public:
+  struct Config
+  {
+    bool force_swscale { false }; /* use swscale even where a hand-written kernel is available */
+    unsigned int num_threads { 1 }; /* convert this many horizontal bands in parallel (not when scaling) */
+
+    uint32_t source_format { V4L2_PIX_FMT_YUYV }; /* or _YUV420 or _NV12, e.g. to scale a 4:2:0 frame */
+    uint16_t output_width { 0 }, output_height { 0 }; /* 0: as the input (even, if not) */
+  };
+
+private:
+  Config config_;
   uint16_t width_, height_;
+  uint32_t source_format_;
+  uint16_t output_width_, output_height_;
 
   struct swscontext_deleter
   {
     void operator()( SwsContext* x ) const { sws_freeContext( x ); }
   };
 
-  std::unique_ptr<SwsContext, swscontext_deleter> context_ {};
+  /* hand-written kernel for the hot path; swscale when unset */
+  std::optional<YUYVToI420::Kernel> kernel_ {};
+
+  /* a run of whole row pairs, converted independently of the others */
+  struct Band
+  {
+    uint16_t first_row, num_rows;
+    std::unique_ptr<SwsContext, swscontext_deleter> context; /* swscale only: sized to the band */
+  };
+
+  std::vector<Band> bands_ {};
+  std::unique_ptr<WorkerPool> pool_ {};
+
+  void convert_band( const Band& band, const FramePlanes& source, std::span<uint8_t> yuv420p ) const;
+
+  /* (re)build the bands, and their swscale contexts, for the current sizes */
+  void configure();
 
 public:
   ColorspaceConverter( const uint16_t width, const uint16_t height );
+  ColorspaceConverter( const uint16_t width, const uint16_t height, const Config& config );
+
+  std::string_view engine() const { return kernel_.has_value() ? YUYVToI420::name( kernel_.value() ) : "swscale"; }
+  unsigned int num_threads() const { return bands_.size(); }
+
+  uint16_t output_width() const { return output_width_; }
+  uint16_t output_height() const { return output_height_; }
+  size_t output_size() const { return 3 * size_t( output_width_ ) * output_height_ / 2; }
+
+  /* scale to a new size from the next frame on (output_size() changes to match) */
+  void set_output_size( const uint16_t width, const uint16_t height );
+
+  void convert( std::string_view source, std::span<uint8_t> yuv420p ) const;
 
-  void convert( std::string_view yuyv422, std::span<uint8_t> yuv420p ) const;
+  /* returns the planes of the converted frame (in `yuv420p`), with the source's capture timestamp */
+  FramePlanes convert( const FramePlanes& source, std::span<uint8_t> yuv420p ) const;
 };
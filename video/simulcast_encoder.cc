@@ -0,0 +1,157 @@
+#include "simulcast_encoder.hh"
+#include "formats.hh"
+#include "timer.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+SimulcastEncoder::SimulcastEncoder( const uint16_t width,
+                                    const uint16_t height,
+                                    const uint32_t source_format,
+                                    const uint8_t fps,
+                                    const Config& config )
+  : source_format_( source_format ), pool_( max( size_t( 1 ), config.layers.size() ) )
+{
+  if ( config.layers.empty() or config.layers.size() > VideoChunk::max_streams ) {
+    throw runtime_error( "SimulcastEncoder: between 1 and " + to_string( VideoChunk::max_streams )
+                         + " layers supported" );
+  }
+
+  for ( const auto& layer : config.layers ) {
+    if ( layer.divisor == 0 or layer.bitrate_kbps == 0 ) {
+      throw runtime_error( "SimulcastEncoder: invalid layer" );
+    }
+
+    /* rounded down to even sizes, for 4:2:0 */
+    const uint16_t layer_width = width / layer.divisor & ~1;
+    const uint16_t layer_height = height / layer.divisor & ~1;
+    if ( layer_width == 0 or layer_height == 0 ) {
+      throw runtime_error( "SimulcastEncoder: layer 1/" + to_string( layer.divisor ) + " is too small" );
+    }
+
+    H264Encoder::Config encoder_config = config.encoder;
+    encoder_config.rate_control = H264Encoder::Config::RateControl::CappedCRF;
+    encoder_config.target_bitrate_kbps = layer.bitrate_kbps;
+    if ( encoder_config.threads == 0 ) {
+      encoder_config.threads = max( size_t( 1 ), thread::hardware_concurrency() / config.layers.size() );
+    }
+
+    /* the full-size layer takes the capture as it is if the encoder can */
+    const bool full_size = layer_width == width and layer_height == height;
+    const bool as_is = full_size and ( source_format != V4L2_PIX_FMT_YUYV or config.encoder.chroma_422 );
+    encoder_config.chroma_422 = as_is and source_format == V4L2_PIX_FMT_YUYV;
+
+    LayerState& state = layers_.emplace_back( LayerState {
+      layer,
+      layer_width,
+      layer_height,
+      {},
+      {},
+      make_unique<H264Encoder>( layer_width, layer_height, fps, encoder_config ),
+    } );
+
+    if ( not as_is ) {
+      state.converter.emplace( width,
+                               height,
+                               ColorspaceConverter::Config { .source_format = source_format,
+                                                             .output_width = layer_width,
+                                                             .output_height = layer_height } );
+      state.buffer.resize( state.converter->output_size() );
+    }
+  }
+
+  outputs_.resize( layers_.size(), &none_ );
+}
+
+void SimulcastEncoder::encode_layer( LayerState& layer, const FramePlanes& frame )
+{
+  const EncodedFrame& encoded
+    = layer.encoder->encode( layer.converter ? layer.converter->convert( frame, layer.buffer ) : frame );
+
+  if ( not encoded.empty() ) {
+    layer.frames++;
+    layer.bytes += encoded.size();
+    layer.encode_time.record( encoded.encode_duration );
+  }
+
+  outputs_[&layer - layers_.data()] = &encoded;
+}
+
+span<const EncodedFrame* const> SimulcastEncoder::encode( const FramePlanes& frame )
+{
+  if ( frame.empty() ) {
+    /* no picture (e.g. a bad capture buffer): no layer has anything to encode */
+    fill( outputs_.begin(), outputs_.end(), &none_ );
+    return outputs_;
+  }
+
+  if ( frame.pixel_format != source_format_ ) {
+    throw runtime_error( "SimulcastEncoder::encode(): unexpected pixel format" );
+  }
+
+  for ( unsigned int i = 0; i < layers_.size(); i++ ) {
+    outputs_[i] = &none_;
+    if ( not layers_[i].active ) {
+      layers_[i].encoder->skip_frame(); /* keep its timestamps in step for when it restarts */
+    }
+  }
+
+  pool_.run( layers_.size(), [&]( const unsigned int i ) {
+    if ( layers_[i].active ) {
+      encode_layer( layers_[i], frame );
+    }
+  } );
+
+  return outputs_;
+}
+
+void SimulcastEncoder::set_active( const unsigned int i, const bool active )
+{
+  LayerState& layer = layers_.at( i );
+  if ( layer.active == active ) {
+    return;
+  }
+
+  layer.active = active;
+  if ( active ) {
+    layer.encoder->request_keyframe();
+  } else {
+    layer.stops++;
+  }
+}
+
+unsigned int SimulcastEncoder::fit_to_bitrate( const unsigned int kbps )
+{
+  /* from the lowest layer up */
+  unsigned int total = 0, running = 0;
+  for ( unsigned int i = layers_.size(); i-- > 0; ) {
+    total += layers_[i].layer.bitrate_kbps;
+    const bool fits = running == 0 or total <= kbps;
+    set_active( i, fits );
+    running += fits;
+  }
+
+  return running;
+}
+
+void SimulcastEncoder::summary( ostream& out ) const
+{
+  out << "Simulcast:";
+  for ( const auto& layer : layers_ ) {
+    out << " [" << layer.width << "x" << layer.height << " @ " << layer.layer.bitrate_kbps << " kbps"
+        << ( layer.active ? "" : " stopped" ) << ": frames=" << layer.frames;
+    out << " MB=" << fixed << setprecision( 1 ) << layer.bytes / 1e6;
+    if ( layer.stops ) {
+      out << " stops=" << layer.stops;
+    }
+    out << " encode p50=";
+    Timer::pp_ns( out, layer.encode_time.percentile_ns( 0.5 ) );
+    out << "]";
+  }
+  out << "\n";
+}
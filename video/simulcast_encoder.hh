@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include "frame_source.hh"
+#include "h264_encoder.hh"
+#include "histogram.hh"
+#include "scale.hh"
+#include "summarize.hh"
+#include "worker_pool.hh"
+
+/* encodes each captured frame at several resolutions and bitrates (layers), so receivers with different
+   needs can each take one without transcoding. Every layer scales (ColorspaceConverter) and encodes with
+   its own H264Encoder, the layers running in parallel on one pool. Layer i goes out as stream i
+   (VideoSource::push). Layers can be stopped and restarted independently, e.g. to fit a congested path. */
+class SimulcastEncoder : public Summarizable
+{
+public:
+  struct Layer
+  {
+    unsigned int divisor; /* of the capture's width and height */
+    unsigned int bitrate_kbps;
+  };
+
+  struct Config
+  {
+    std::vector<Layer> layers { { 1, 4000 }, { 2, 1200 }, { 4, 400 } }; /* best first */
+
+    /* for every layer's encoder (with CappedCRF rate control at the layer's bitrate). A zero threads gives
+       each layer an equal share of the cores. */
+    H264Encoder::Config encoder {};
+  };
+
+private:
+  struct LayerState
+  {
+    Layer layer;
+    uint16_t width, height;
+    std::optional<ColorspaceConverter> converter; /* unless the capture can go to the encoder as it is */
+    std::vector<uint8_t> buffer {};
+    std::unique_ptr<H264Encoder> encoder;
+
+    bool active { true };
+
+    unsigned int frames {}, stops {};
+    uint64_t bytes {};
+    LatencyHistogram encode_time {};
+  };
+
+  uint32_t source_format_;
+  std::vector<LayerState> layers_ {};
+  std::vector<const EncodedFrame*> outputs_ {};
+  EncodedFrame none_ {};
+  WorkerPool pool_;
+
+  void encode_layer( LayerState& layer, const FramePlanes& frame );
+
+public:
+  SimulcastEncoder( const uint16_t width,
+                    const uint16_t height,
+                    const uint32_t source_format,
+                    const uint8_t fps,
+                    const Config& config );
+
+  /* encode the frame for every active layer; output i is layer i's (empty if stopped or still held by the
+     encoder), valid until the next call. An empty frame yields only empty outputs. */
+  std::span<const EncodedFrame* const> encode( const FramePlanes& frame );
+
+  unsigned int num_layers() const { return layers_.size(); }
+  H264Encoder& layer_encoder( const unsigned int i ) { return *layers_.at( i ).encoder; }
+
+  /* a stopped layer costs nothing; it restarts with a keyframe, since its receivers have missed frames */
+  void set_active( const unsigned int i, const bool active );
+  bool active( const unsigned int i ) const { return layers_.at( i ).active; }
+
+  /* run the lowest layers whose bitrates fit in `kbps` between them (the lowest always runs); returns how
+     many are running. Call VideoSource::discard_stream() for the layers this stops. */
+  unsigned int fit_to_bitrate( const unsigned int kbps );
+
+  void summary( std::ostream& out ) const override;
+};
@@ -0,0 +1,294 @@
+#include "static_scene.hh"
+#include "h264_encoder.hh"
+#include "timer.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <linux/videodev2.h>
+#include <stdexcept>
+#include <string>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define STATIC_SCENE_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/* sum of absolute differences over `length` bytes (a multiple of 16) */
+static unsigned int sad_scalar( const uint8_t* a, const uint8_t* b, const unsigned int length )
+{
+  unsigned int sum = 0;
+  for ( unsigned int i = 0; i < length; i++ ) {
+    sum += abs( a[i] - b[i] );
+  }
+  return sum;
+}
+
+#ifdef STATIC_SCENE_X86
+
+__attribute__( ( target( "sse2" ) ) ) static unsigned int sad_sse2( const uint8_t* a,
+                                                                   const uint8_t* b,
+                                                                   const unsigned int length )
+{
+  __m128i sum = _mm_setzero_si128();
+  for ( unsigned int i = 0; i < length; i += 16 ) {
+    sum = _mm_add_epi64( sum,
+                         _mm_sad_epu8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + i ) ),
+                                       _mm_loadu_si128( reinterpret_cast<const __m128i*>( b + i ) ) ) );
+  }
+
+  /* psadbw leaves one sum per 64-bit half */
+  return _mm_cvtsi128_si32( sum ) + _mm_cvtsi128_si32( _mm_unpackhi_epi64( sum, sum ) );
+}
+
+__attribute__( ( target( "avx2" ) ) ) static unsigned int sad_avx2( const uint8_t* a,
+                                                                   const uint8_t* b,
+                                                                   const unsigned int length )
+{
+  __m256i sum = _mm256_setzero_si256();
+  unsigned int i = 0;
+  for ( ; i + 32 <= length; i += 32 ) {
+    sum = _mm256_add_epi64( sum,
+                            _mm256_sad_epu8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( a + i ) ),
+                                             _mm256_loadu_si256( reinterpret_cast<const __m256i*>( b + i ) ) ) );
+  }
+
+  const __m128i halves = _mm_add_epi64( _mm256_castsi256_si128( sum ), _mm256_extracti128_si256( sum, 1 ) );
+  unsigned int total = _mm_cvtsi128_si32( halves ) + _mm_cvtsi128_si32( _mm_unpackhi_epi64( halves, halves ) );
+
+  if ( i < length ) {
+    total += sad_sse2( a + i, b + i, length - i );
+  }
+
+  return total;
+}
+
+#endif
+
+static unsigned int sad( const StaticSceneDetector::Kernel kernel,
+                         const uint8_t* a,
+                         const uint8_t* b,
+                         const unsigned int length )
+{
+  switch ( kernel ) {
+#ifdef STATIC_SCENE_X86
+    case StaticSceneDetector::Kernel::AVX2:
+      return sad_avx2( a, b, length );
+    case StaticSceneDetector::Kernel::SSE2:
+      return sad_sse2( a, b, length );
+#endif
+    default:
+      return sad_scalar( a, b, length );
+  }
+}
+
+/* bytes per pixel in the first plane */
+static unsigned int first_plane_bytes_per_pixel( const uint32_t pixel_format )
+{
+  return pixel_format == V4L2_PIX_FMT_YUYV ? 2 : 1;
+}
+
+/* calls f( block row pointer, reference offset ) for every row of every sampled block */
+template<class F>
+static void for_each_block_row( const FramePlanes& frame,
+                                const StaticSceneDetector::Config& config,
+                                const unsigned int row_bytes,
+                                F&& f )
+{
+  const FramePlanes::Plane& plane = frame.planes.at( 0 );
+  const unsigned int bytes_per_pixel = first_plane_bytes_per_pixel( frame.pixel_format );
+
+  size_t offset = 0;
+  for ( unsigned int y = 0; y + StaticSceneDetector::BLOCK_ROWS <= frame.height; y += config.spacing_y ) {
+    for ( unsigned int x = 0; x + StaticSceneDetector::BLOCK_PIXELS <= frame.width; x += config.spacing_x ) {
+      for ( unsigned int row = 0; row < StaticSceneDetector::BLOCK_ROWS; row++ ) {
+        f( plane.data + size_t( y + row ) * plane.stride + x * bytes_per_pixel, offset );
+        offset += row_bytes;
+      }
+    }
+  }
+}
+
+StaticSceneDetector::Kernel StaticSceneDetector::best_kernel()
+{
+  static const Kernel best = [] {
+    if ( supported( Kernel::AVX2 ) ) {
+      return Kernel::AVX2;
+    } else if ( supported( Kernel::SSE2 ) ) {
+      return Kernel::SSE2;
+    }
+    return Kernel::Scalar;
+  }();
+
+  return best;
+}
+
+bool StaticSceneDetector::supported( const Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar:
+      return true;
+#ifdef STATIC_SCENE_X86
+    case Kernel::SSE2:
+      return __builtin_cpu_supports( "sse2" );
+    case Kernel::AVX2:
+      return __builtin_cpu_supports( "avx2" );
+#endif
+    default:
+      return false;
+  }
+}
+
+string_view StaticSceneDetector::name( const Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar:
+      return "scalar";
+    case Kernel::SSE2:
+      return "SSE2";
+    case Kernel::AVX2:
+      return "AVX2";
+  }
+
+  return "unknown";
+}
+
+StaticSceneDetector::StaticSceneDetector() : StaticSceneDetector( Config {} ) {}
+
+StaticSceneDetector::StaticSceneDetector( const Config& config, const Kernel kernel )
+  : config_( config ), kernel_( kernel )
+{
+  if ( config_.spacing_x < BLOCK_PIXELS or config_.spacing_y < BLOCK_ROWS ) {
+    throw runtime_error( "StaticSceneDetector: sampled blocks would overlap" );
+  }
+
+  if ( not supported( kernel_ ) ) {
+    throw runtime_error( "StaticSceneDetector: " + string( name( kernel_ ) )
+                         + " kernel not supported on this CPU" );
+  }
+}
+
+bool StaticSceneDetector::same_layout( const FramePlanes& frame ) const
+{
+  return not reference_.empty() and frame.pixel_format == pixel_format_ and frame.width == width_
+         and frame.height == height_;
+}
+
+void StaticSceneDetector::take_reference( const FramePlanes& frame )
+{
+  const unsigned int row_bytes = BLOCK_PIXELS * first_plane_bytes_per_pixel( frame.pixel_format );
+
+  pixel_format_ = frame.pixel_format;
+  width_ = frame.width;
+  height_ = frame.height;
+
+  reference_.clear();
+  for_each_block_row( frame, config_, row_bytes, [&]( const uint8_t* row, size_t ) {
+    reference_.insert( reference_.end(), row, row + row_bytes );
+  } );
+}
+
+bool StaticSceneDetector::differs( const FramePlanes& frame ) const
+{
+  const unsigned int row_bytes = BLOCK_PIXELS * first_plane_bytes_per_pixel( frame.pixel_format );
+  const unsigned int block_limit = config_.block_threshold * row_bytes * BLOCK_ROWS;
+
+  uint64_t total = 0;
+  unsigned int block = 0;
+  bool block_changed = false;
+
+  for_each_block_row( frame, config_, row_bytes, [&]( const uint8_t* row, const size_t offset ) {
+    if ( block_changed ) {
+      return;
+    }
+
+    block += sad( kernel_, row, reference_.data() + offset, row_bytes );
+    if ( ( offset / row_bytes ) % BLOCK_ROWS == BLOCK_ROWS - 1 ) {
+      block_changed = block > block_limit;
+      total += block;
+      block = 0;
+    }
+  } );
+
+  return block_changed or total > config_.frame_threshold * reference_.size();
+}
+
+StaticSceneDetector::Verdict StaticSceneDetector::check( const FramePlanes& frame, const uint64_t now )
+{
+  if ( frame.empty() ) {
+    return Verdict::Changed;
+  }
+
+  const uint64_t start = Timer::timestamp_ns();
+  frames_checked_++;
+
+  Verdict verdict = Verdict::Changed;
+  if ( same_layout( frame ) and not differs( frame ) ) {
+    verdict = now < last_encoded_ + config_.max_skip_ns ? Verdict::Unchanged : Verdict::KeepAlive;
+  }
+
+  switch ( verdict ) {
+    case Verdict::Changed:
+      take_reference( frame );
+      last_encoded_ = now;
+      break;
+
+    case Verdict::KeepAlive:
+      /* the reference stays: it is the same picture */
+      last_encoded_ = now;
+      keepalives_++;
+      keepalive_captures_[next_keepalive_++ % keepalive_captures_.size()] = frame.capture_timestamp;
+      break;
+
+    case Verdict::Unchanged: {
+      frames_skipped_++;
+      const bool measured = static_encode_ns_ > 0;
+      est_cpu_saved_ns_ += convert_ns_ + ( measured ? static_encode_ns_ : encode_ns_ );
+      est_bytes_saved_ += measured ? static_encode_bytes_ : encode_bytes_;
+      break;
+    }
+  }
+
+  detect_ns_ += Timer::timestamp_ns() - start;
+  return verdict;
+}
+
+void StaticSceneDetector::record_conversion( const uint64_t convert_ns )
+{
+  convert_ns_ = convert_ns_ ? 0.9 * convert_ns_ + 0.1 * convert_ns : convert_ns;
+}
+
+void StaticSceneDetector::record_encoded( const EncodedFrame& frame )
+{
+  if ( frame.empty() ) {
+    return;
+  }
+
+  const auto update = []( float& average, const float sample ) {
+    average = average ? 0.9 * average + 0.1 * sample : sample;
+  };
+
+  update( encode_ns_, frame.encode_duration );
+  update( encode_bytes_, frame.size() );
+
+  if ( frame.capture_timestamp
+       and find( keepalive_captures_.begin(), keepalive_captures_.end(), frame.capture_timestamp )
+             != keepalive_captures_.end() ) {
+    update( static_encode_ns_, frame.encode_duration );
+    update( static_encode_bytes_, frame.size() );
+  }
+}
+
+void StaticSceneDetector::summary( ostream& out ) const
+{
+  out << "Static scene (" << name( kernel_ ) << "): skipped " << frames_skipped_ << "/" << frames_checked_;
+  out << " keepalives=" << keepalives_ << " detection=";
+  Timer::pp_ns( out, frames_checked_ ? detect_ns_ / frames_checked_ : 0 );
+  out << "/frame est. saved: cpu=";
+  Timer::pp_ns( out, est_cpu_saved_ns_ );
+  out << " (net ";
+  Timer::pp_ns( out, est_cpu_saved_ns_ > detect_ns_ ? est_cpu_saved_ns_ - detect_ns_ : 0 );
+  out << ") bits=" << fixed << setprecision( 1 ) << est_bytes_saved_ * 8 / MILLION << " Mbit\n";
+}
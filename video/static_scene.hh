@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "frame_source.hh"
+#include "summarize.hh"
+
+struct EncodedFrame;
+
+/* spots frames that haven't changed since the last one encoded, so they can skip conversion and encoding.
+   Compares a grid of small blocks sampled from the first plane (packed YUYV, or the luma plane) with the
+   same blocks of the last frame let through, by SIMD sum of absolute differences. Comparing against the
+   last frame encoded (not the previous frame) means slow drift still adds up to a change. */
+class StaticSceneDetector : public Summarizable
+{
+public:
+  enum class Kernel
+  {
+    Scalar,
+    SSE2,
+    AVX2
+  };
+
+  struct Config
+  {
+    /* one sampled block of BLOCK_PIXELS x BLOCK_ROWS per this many pixels across and rows down */
+    unsigned int spacing_x { 64 };
+    unsigned int spacing_y { 16 };
+
+    /* changed if the mean absolute difference per byte passes block_threshold in any one block (a small
+       moving object), or frame_threshold over all the blocks (e.g. the lighting) */
+    float block_threshold { 10 };
+    float frame_threshold { 3 };
+
+    uint64_t max_skip_ns { 1'000'000'000 }; /* encode at least this often, so the stream stays live */
+  };
+
+  static constexpr unsigned int BLOCK_PIXELS = 16;
+  static constexpr unsigned int BLOCK_ROWS = 4;
+
+  enum class Verdict
+  {
+    Changed,   /* encode */
+    KeepAlive, /* unchanged, but encode anyway: max_skip_ns has passed */
+    Unchanged  /* skip */
+  };
+
+  static Kernel best_kernel();
+  static bool supported( const Kernel kernel );
+  static std::string_view name( const Kernel kernel );
+
+private:
+  Config config_;
+  Kernel kernel_;
+
+  /* the layout the reference was taken from (any change counts as a change of scene) */
+  uint32_t pixel_format_ {};
+  uint16_t width_ {}, height_ {};
+
+  std::vector<uint8_t> reference_ {}; /* the sampled blocks of the last frame let through, back to back */
+  uint64_t last_encoded_ {};
+
+  /* keepalive frames are unchanged frames that got encoded anyway: the best measure of what a skipped
+     frame would have cost */
+  std::array<uint64_t, 8> keepalive_captures_ {};
+  unsigned int next_keepalive_ {};
+
+  float encode_ns_ {}, encode_bytes_ {}, static_encode_ns_ {}, static_encode_bytes_ {}, convert_ns_ {};
+
+  unsigned int frames_checked_ {}, frames_skipped_ {}, keepalives_ {};
+  uint64_t detect_ns_ {}, est_cpu_saved_ns_ {}, est_bytes_saved_ {};
+
+  bool same_layout( const FramePlanes& frame ) const;
+  void take_reference( const FramePlanes& frame );
+
+  /* returns whether the frame differs from the reference by more than the thresholds */
+  bool differs( const FramePlanes& frame ) const;
+
+public:
+  StaticSceneDetector();
+  explicit StaticSceneDetector( const Config& config, const Kernel kernel = best_kernel() );
+
+  /* for each captured frame, before converting it: encode it or skip it? `now` in Timer::timestamp_ns() */
+  Verdict check( const FramePlanes& frame, const uint64_t now );
+
+  /* what the frames that were encoded cost, for the estimates of what skipping saved */
+  void record_conversion( const uint64_t convert_ns );
+  void record_encoded( const EncodedFrame& frame );
+
+  void summary( std::ostream& out ) const override;
+};
@@ -0,0 +1,239 @@
+#include "synthetic_source.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <ostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+struct YUV
+{
+  uint8_t y, u, v;
+};
+
+/* 75% colour bars, BT.601 limited range */
+constexpr array<YUV, 8> bar_colours { { { 180, 128, 128 },
+                                        { 162, 44, 142 },
+                                        { 131, 156, 44 },
+                                        { 112, 72, 58 },
+                                        { 84, 184, 198 },
+                                        { 65, 100, 212 },
+                                        { 35, 212, 114 },
+                                        { 16, 128, 128 } } };
+
+YUV bar_colour( const size_t x, const size_t width )
+{
+  return bar_colours.at( ( x % width ) * bar_colours.size() / width );
+}
+
+YUV ramp_colour( const size_t x, const size_t width )
+{
+  return { static_cast<uint8_t>( 16 + ( x % width ) * 219 / width ), 128, 128 };
+}
+
+enum class Band
+{
+  Bars,
+  Noise,
+  Ramp
+};
+
+Band band_of_row( const size_t row, const size_t height )
+{
+  if ( row < 5 * height / 8 ) {
+    return Band::Bars;
+  } else if ( row < 6 * height / 8 ) {
+    return Band::Noise;
+  } else {
+    return Band::Ramp;
+  }
+}
+
+/* position along a path that bounces between 0 and `range` */
+size_t bounce( const uint64_t distance, const size_t range )
+{
+  if ( range == 0 ) {
+    return 0;
+  }
+  const uint64_t phase = distance % ( 2 * range );
+  return phase < range ? phase : 2 * range - phase;
+}
+
+}
+
+SyntheticSource::SyntheticSource( const uint16_t width,
+                                  const uint16_t height,
+                                  const uint32_t pixel_format,
+                                  const unsigned int frame_rate,
+                                  const bool paced )
+  : width_( width )
+  , height_( height )
+  , pixel_format_( pixel_format )
+  , frame_rate_( frame_rate )
+  , clock_( frame_rate, paced )
+  , frame_()
+{
+  if ( width_ % 2 or height_ % 2 or width_ < 8 or height_ < 8 ) {
+    throw runtime_error( "SyntheticSource: width and height must be even and at least 8" );
+  }
+
+  const size_t strip_pixels = 2 * width_;
+
+  switch ( pixel_format_ ) {
+    case V4L2_PIX_FMT_YUYV: {
+      /* one packed plane: Y0 U Y1 V */
+      PlaneStrips& packed = strips_.emplace_back();
+      for ( size_t x = 0; x < strip_pixels; x += 2 ) {
+        const YUV bar0 = bar_colour( x, width_ ), bar1 = bar_colour( x + 1, width_ );
+        packed.bars.insert( packed.bars.end(), { bar0.y, bar0.u, bar1.y, bar0.v } );
+        const YUV ramp0 = ramp_colour( x, width_ ), ramp1 = ramp_colour( x + 1, width_ );
+        packed.ramp.insert( packed.ramp.end(), { ramp0.y, ramp0.u, ramp1.y, ramp0.v } );
+      }
+      frame_.resize( 2 * width_ * height_ );
+      break;
+    }
+
+    case V4L2_PIX_FMT_YUV420: {
+      /* three planes; chroma is sited at even luma positions */
+      strips_.resize( 3 );
+      for ( size_t x = 0; x < strip_pixels; x++ ) {
+        strips_[0].bars.push_back( bar_colour( x, width_ ).y );
+        strips_[0].ramp.push_back( ramp_colour( x, width_ ).y );
+        if ( x % 2 == 0 ) {
+          strips_[1].bars.push_back( bar_colour( x, width_ ).u );
+          strips_[1].ramp.push_back( ramp_colour( x, width_ ).u );
+          strips_[2].bars.push_back( bar_colour( x, width_ ).v );
+          strips_[2].ramp.push_back( ramp_colour( x, width_ ).v );
+        }
+      }
+      frame_.resize( 3 * width_ * height_ / 2 );
+      break;
+    }
+
+    default:
+      throw runtime_error( "SyntheticSource: unsupported pixel format (only YUYV and YUV420)" );
+  }
+
+  render();
+}
+
+void SyntheticSource::render()
+{
+  const bool packed = pixel_format_ == V4L2_PIX_FMT_YUYV;
+
+  /* the bars scroll right, the ramp scrolls left (offsets in luma pixels, always even) */
+  const size_t bars_offset = ( width_ - ( frame_number_ * 4 ) % width_ ) % width_;
+  const size_t ramp_offset = ( frame_number_ * 2 ) % width_;
+
+  uint8_t* plane = frame_.data();
+  for ( size_t p = 0; p < strips_.size(); p++ ) {
+    const bool chroma = p > 0;
+    const size_t bytes_per_row = packed ? 2 * width_ : ( chroma ? width_ / 2 : width_ );
+    const size_t rows = chroma ? height_ / 2 : height_;
+    const size_t vertical_subsampling = chroma ? 2 : 1;
+
+    /* byte offset into the strip for a given luma pixel offset */
+    const auto strip_position = [&]( const size_t pixel_offset ) {
+      return packed ? 2 * pixel_offset : ( chroma ? pixel_offset / 2 : pixel_offset );
+    };
+
+    for ( size_t row = 0; row < rows; row++ ) {
+      uint8_t* dest = plane + row * bytes_per_row;
+      switch ( band_of_row( row * vertical_subsampling, height_ ) ) {
+        case Band::Bars:
+          memcpy( dest, strips_[p].bars.data() + strip_position( bars_offset ), bytes_per_row );
+          break;
+
+        case Band::Ramp:
+          memcpy( dest, strips_[p].ramp.data() + strip_position( ramp_offset ), bytes_per_row );
+          break;
+
+        case Band::Noise:
+          if ( chroma ) {
+            memset( dest, 128, bytes_per_row );
+            break;
+          }
+
+          /* xorshift64*, eight bytes at a time */
+          for ( size_t i = 0; i < bytes_per_row; i += sizeof( uint64_t ) ) {
+            rng_state_ ^= rng_state_ >> 12;
+            rng_state_ ^= rng_state_ << 25;
+            rng_state_ ^= rng_state_ >> 27;
+            const uint64_t random = rng_state_ * 0x2545F4914F6CDD1D;
+            memcpy( dest + i, &random, min( sizeof( random ), bytes_per_row - i ) );
+          }
+
+          if ( packed ) {
+            for ( size_t i = 1; i < bytes_per_row; i += 2 ) {
+              dest[i] = 128;
+            }
+          }
+          break;
+      }
+    }
+
+    plane += bytes_per_row * rows;
+  }
+
+  /* the bouncing box */
+  const size_t box_size = ( height_ / 6 ) & ~size_t( 1 );
+  const size_t box_x = bounce( frame_number_ * 6, width_ - box_size ) & ~size_t( 1 );
+  const size_t box_y = bounce( frame_number_ * 4, height_ - box_size ) & ~size_t( 1 );
+
+  if ( packed ) {
+    for ( size_t row = box_y; row < box_y + box_size; row++ ) {
+      uint8_t* dest = frame_.data() + row * 2 * width_ + 2 * box_x;
+      for ( size_t i = 0; i < 2 * box_size; i += 2 ) {
+        dest[i] = 235;
+        dest[i + 1] = 128;
+      }
+    }
+  } else {
+    for ( size_t row = box_y; row < box_y + box_size; row++ ) {
+      memset( frame_.data() + row * width_ + box_x, 235, box_size );
+    }
+    for ( size_t p = 1; p < 3; p++ ) {
+      uint8_t* chroma_plane = frame_.data() + width_ * height_ + ( p - 1 ) * ( width_ / 2 ) * ( height_ / 2 );
+      for ( size_t row = box_y / 2; row < ( box_y + box_size ) / 2; row++ ) {
+        memset( chroma_plane + row * ( width_ / 2 ) + box_x / 2, 128, box_size / 2 );
+      }
+    }
+  }
+}
+
+string_view SyntheticSource::borrow_next_frame()
+{
+  clock_.ticks();
+  frame_number_++;
+  frames_generated_++;
+  render();
+  return { reinterpret_cast<const char*>( frame_.data() ), frame_.size() };
+}
+
+string_view SyntheticSource::borrow_most_recent_frame()
+{
+  const uint64_t ticks = clock_.ticks();
+  if ( ticks > 1 ) {
+    frames_skipped_ += ticks - 1;
+  }
+  frame_number_ += max( ticks, uint64_t( 1 ) );
+  frames_generated_++;
+  render();
+  return { reinterpret_cast<const char*>( frame_.data() ), frame_.size() };
+}
+
+void SyntheticSource::summary( ostream& out ) const
+{
+  out << "Synthetic source summary (" << width_ << "x" << height_ << " @ " << frame_rate_ << " fps)"
+      << "\n------------------------\n\n";
+
+  out << "Frames generated: " << frames_generated_ << "\n";
+  out << "Frames skipped: " << frames_skipped_ << " ("
+      << nearbyint( 1000.0 * frames_skipped_ / max( 1U, frames_generated_ + frames_skipped_ ) ) / 10.0 << "%)\n";
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "frame_clock.hh"
+#include "frame_source.hh"
+
+/* generates a moving test pattern (scrolling colour bars, a scrolling luma ramp,
+   a bouncing box and a band of fresh noise) at any size and frame rate */
+class SyntheticSource : public FrameSource
+{
+  uint16_t width_;
+  uint16_t height_;
+  uint32_t pixel_format_;
+  unsigned int frame_rate_;
+
+  FrameClock clock_;
+
+  /* one row of each pattern, twice the frame width so any window of `width_` is contiguous */
+  struct PlaneStrips
+  {
+    std::vector<uint8_t> bars {}, ramp {};
+  };
+  std::vector<PlaneStrips> strips_ {};
+
+  std::vector<uint8_t> frame_;
+  uint64_t frame_number_ {};
+  uint64_t rng_state_ { 0x9E3779B97F4A7C15 };
+
+  void render();
+
+  unsigned int frames_generated_ {};
+  unsigned int frames_skipped_ {};
+
+public:
+  SyntheticSource( const uint16_t width,
+                   const uint16_t height,
+                   const uint32_t pixel_format,
+                   const unsigned int frame_rate,
+                   const bool paced = true );
+
+  uint16_t width() const override { return width_; }
+  uint16_t height() const override { return height_; }
+  uint32_t pixel_format() const override { return pixel_format_; }
+
+  FileDescriptor& fd() override { return clock_.fd(); }
+
+  std::string_view borrow_next_frame() override;
+  std::string_view borrow_most_recent_frame() override;
+  void release_frame() override {}
+
+  void summary( std::ostream& out ) const override;
+};
@@ -0,0 +1,152 @@
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <poll.h>
+
+#include "exception.hh"
+#include "threaded_camera.hh"
+
+using namespace std;
+
+ThreadedCamera::ThreadedCamera( unique_ptr<Camera> camera )
+  : camera_( move( camera ) ), capture_thread_( [this] { capture_loop(); } )
+{}
+
+ThreadedCamera::~ThreadedCamera()
+{
+  try {
+    stop_.signal();
+  } catch ( const exception& e ) {
+    cerr << "ThreadedCamera destructor failed on exception of type " << demangle( typeid( e ).name() ) << ": "
+         << e.what() << "\n";
+  }
+
+  capture_thread_.join();
+}
+
+void ThreadedCamera::capture_loop()
+{
+  try {
+    array<pollfd, 2> fds { { { camera_->fd().fd_num(), POLLIN, 0 }, { stop_.fd_num(), POLLIN, 0 } } };
+
+    while ( true ) {
+      if ( poll( fds.data(), fds.size(), -1 ) < 0 ) {
+        if ( errno == EINTR ) {
+          continue;
+        }
+        throw unix_error( "poll" );
+      }
+
+      if ( fds[1].revents ) {
+        return;
+      }
+
+      if ( fds[0].revents & ( POLLERR | POLLHUP | POLLNVAL ) ) {
+        throw runtime_error( "ThreadedCamera: camera stopped delivering frames" );
+      }
+
+      requeue_returned_buffers();
+
+      while ( const auto dequeued = camera_->try_dequeue_buffer() ) {
+        frames_dequeued_++;
+
+        if ( not dequeued->good ) {
+          frames_failed_++;
+          camera_->enqueue_buffer( dequeued->index );
+          continue;
+        }
+
+        publish( dequeued->index );
+      }
+    }
+  } catch ( ... ) {
+    capture_error_ = current_exception();
+    capture_failed_.store( true, memory_order_release );
+    doorbell_.signal();
+  }
+}
+
+void ThreadedCamera::requeue_returned_buffers()
+{
+  uint32_t returned = returned_buffers_.exchange( 0, memory_order_acquire );
+  while ( returned ) {
+    const unsigned int index = __builtin_ctz( returned );
+    camera_->enqueue_buffer( index );
+    returned &= returned - 1;
+  }
+}
+
+void ThreadedCamera::publish( const unsigned int index )
+{
+  const uint32_t previous = latest_.exchange( index, memory_order_acq_rel );
+
+  if ( previous == EMPTY ) {
+    /* the consumer has taken everything so far: wake it up */
+    doorbell_.signal();
+    return;
+  }
+
+  /* the consumer never took the previous frame, and now never will (the doorbell is still ringing) */
+  frames_skipped_++;
+  camera_->enqueue_buffer( previous );
+}
+
+void ThreadedCamera::check_capture_thread() const
+{
+  if ( capture_failed_.load( memory_order_acquire ) ) {
+    rethrow_exception( capture_error_ );
+  }
+}
+
+FramePlanes ThreadedCamera::borrow_most_recent_planes()
+{
+  check_capture_thread();
+  doorbell_.read_event();
+
+  if ( borrowed_.has_value() ) {
+    throw runtime_error( "ThreadedCamera: previous frame was not released" );
+  }
+
+  const uint32_t index = latest_.exchange( EMPTY, memory_order_acquire );
+  if ( index == EMPTY ) {
+    return {};
+  }
+
+  borrowed_ = index;
+  frames_delivered_++;
+  return camera_->planes_of_buffer( index );
+}
+
+string_view ThreadedCamera::borrow_most_recent_frame()
+{
+  if ( borrow_most_recent_planes().empty() ) {
+    return {};
+  }
+
+  return camera_->frame_of_buffer( borrowed_.value() );
+}
+
+void ThreadedCamera::release_frame()
+{
+  if ( borrowed_.has_value() ) {
+    returned_buffers_.fetch_or( 1U << borrowed_.value(), memory_order_release );
+    borrowed_.reset();
+  }
+}
+
+void ThreadedCamera::summary( ostream& out ) const
+{
+  const uint64_t dequeued = frames_dequeued_;
+  const uint64_t failed = frames_failed_;
+  const uint64_t skipped = frames_skipped_;
+  const uint64_t good = dequeued - failed;
+
+  out << "Threaded camera summary (" << camera_->description() << ")"
+      << "\n------------------------\n\n";
+
+  out << "Frame successes/attempts: " << good << "/" << dequeued << "\n";
+  out << "Frames delivered: " << frames_delivered_ << "\n";
+  out << "Frames skipped: " << skipped << " (" << ( good ? nearbyint( 1000.0 * skipped / good ) / 10.0 : 0 )
+      << "%)\n";
+  out << "Frame failures: " << failed << "\n";
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <thread>
+
+#include "camera.hh"
+#include "eventfd.hh"
+#include "frame_source.hh"
+
+/* a Camera whose V4L2 fd is owned by a capture thread. The thread dequeues every frame as it arrives and
+   publishes the newest buffer through a lock-free slot; the consumer always gets the freshest frame, and
+   the handoff itself needs no ioctls on the consumer's side. fd() becomes readable when a fresh frame has
+   been published. Buffers released by the consumer go back to the capture thread to requeue. */
+class ThreadedCamera : public FrameSource
+{
+  static constexpr uint32_t EMPTY = 0xFFFF'FFFF;
+
+  static_assert( Camera::num_buffers() <= 32, "returned_buffers_ needs a bit per buffer" );
+
+  std::unique_ptr<Camera> camera_;
+
+  /* capture thread => consumer: the newest buffer index not yet taken, or EMPTY */
+  std::atomic<uint32_t> latest_ { EMPTY };
+
+  /* consumer => capture thread: a bit per buffer waiting to be requeued */
+  std::atomic<uint32_t> returned_buffers_ { 0 };
+
+  /* held by the consumer between borrow and release */
+  std::optional<unsigned int> borrowed_ {};
+
+  EventFD doorbell_ {}; /* rung when a fresh frame is published */
+  EventFD stop_ {};     /* asks the capture thread to exit */
+
+  std::exception_ptr capture_error_ {};
+  std::atomic<bool> capture_failed_ { false };
+
+  std::atomic<uint64_t> frames_dequeued_ { 0 };
+  std::atomic<uint64_t> frames_failed_ { 0 };
+  std::atomic<uint64_t> frames_skipped_ { 0 }; /* published, then replaced before the consumer took them */
+  uint64_t frames_delivered_ { 0 };
+
+  std::thread capture_thread_;
+
+  void capture_loop();
+  void requeue_returned_buffers();
+  void publish( const unsigned int index );
+
+  void check_capture_thread() const;
+
+public:
+  explicit ThreadedCamera( std::unique_ptr<Camera> camera );
+  ~ThreadedCamera();
+
+  uint16_t width() const override { return camera_->width(); }
+  uint16_t height() const override { return camera_->height(); }
+  uint32_t pixel_format() const override { return camera_->pixel_format(); }
+
+  /* there is only ever one frame on offer (the newest), so both flavours return it */
+  std::string_view borrow_next_frame() override { return borrow_most_recent_frame(); }
+  std::string_view borrow_most_recent_frame() override;
+  FramePlanes borrow_next_planes() override { return borrow_most_recent_planes(); }
+  FramePlanes borrow_most_recent_planes() override;
+  void release_frame() override;
+
+  FileDescriptor& fd() override { return doorbell_; }
+
+  void summary( std::ostream& out ) const override;
+  void reset_summary() override {};
+
+  ThreadedCamera( const ThreadedCamera& other ) = delete;
+  ThreadedCamera& operator=( const ThreadedCamera& other ) = delete;
+};
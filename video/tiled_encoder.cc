@@ -0,0 +1,52 @@
+#include "tiled_encoder.hh"
+#include "formats.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+TiledEncoder::TiledEncoder( const uint16_t width,
+                            const uint16_t height,
+                            const uint8_t fps,
+                            const unsigned int num_tiles,
+                            const H264Encoder::Config& config )
+  : tile_width_( num_tiles ? width / num_tiles : 0 ), pool_( max( 1u, num_tiles ) )
+{
+  if ( num_tiles == 0 or num_tiles > VideoChunk::max_streams ) {
+    throw runtime_error( "TiledEncoder: between 1 and " + to_string( VideoChunk::max_streams )
+                         + " tiles supported" );
+  }
+
+  if ( width % num_tiles or tile_width_ % 2 ) {
+    throw runtime_error( "TiledEncoder: width " + to_string( width ) + " doesn't split into "
+                         + to_string( num_tiles ) + " tiles of an even width" );
+  }
+
+  H264Encoder::Config tile_config = config;
+  if ( tile_config.threads == 0 ) {
+    tile_config.threads = max( 1u, thread::hardware_concurrency() / num_tiles );
+  }
+
+  for ( unsigned int i = 0; i < num_tiles; i++ ) {
+    tiles_.push_back( make_unique<H264Encoder>( tile_width_, height, fps, tile_config ) );
+  }
+
+  outputs_.resize( num_tiles );
+}
+
+span<const EncodedFrame* const> TiledEncoder::encode( const FramePlanes& frame )
+{
+  if ( frame.width != tile_width_ * tiles_.size() ) {
+    throw runtime_error( "TiledEncoder::encode(): frame is " + to_string( frame.width ) + " wide, expected "
+                         + to_string( tile_width_ * tiles_.size() ) );
+  }
+
+  pool_.run( tiles_.size(), [&]( const unsigned int i ) {
+    outputs_[i] = &tiles_[i]->encode( crop_columns( frame, i * tile_width_, tile_width_ ) );
+  } );
+
+  return outputs_;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "frame_source.hh"
+#include "h264_encoder.hh"
+#include "worker_pool.hh"
+
+/* encodes each frame as N side-by-side tiles (e.g. the two 1280x720 views of a 2560x720 capture), with an
+   independent H264Encoder per tile running in parallel, so no one x264 context limits throughput or
+   latency. Each tile is a stream of its own: send tile i as stream i (VideoSource::push). */
+class TiledEncoder
+{
+  uint16_t tile_width_;
+  std::vector<std::unique_ptr<H264Encoder>> tiles_ {};
+  std::vector<const EncodedFrame*> outputs_ {};
+  WorkerPool pool_;
+
+public:
+  /* width must split into num_tiles tiles of an even width. A zero config.threads gives each tile an equal
+     share of the cores. */
+  TiledEncoder( const uint16_t width,
+                const uint16_t height,
+                const uint8_t fps,
+                const unsigned int num_tiles,
+                const H264Encoder::Config& config );
+
+  /* encode every tile of the frame; output i is tile i's (empty if its encoder is still holding it), valid
+     until the next call */
+  std::span<const EncodedFrame* const> encode( const FramePlanes& frame );
+
+  unsigned int num_tiles() const { return tiles_.size(); }
+  uint16_t tile_width() const { return tile_width_; }
+
+  /* for calls to make on every tile's encoder (request_keyframe, set_target_bitrate...) */
+  H264Encoder& tile( const unsigned int i ) { return *tiles_.at( i ); }
+};
@@ -1,53 +1,135 @@
 #include "video_source.hh"
 #include "timer.hh"
 
+#include <algorithm>
+
 using namespace std;
 
-static constexpr uint64_t frame_interval = 40'000'000; /* almost 1/24 s */
+static constexpr uint64_t recovery_holdoff = 500'000'000;  /* before the same loss may be reported again */
+static constexpr size_t recent_frames_kept = 256;
+
+VideoSource::VideoSource() : VideoSource( Pacer::Config {} ) {}
+
+VideoSource::VideoSource( const Pacer::Config& pacing ) : pacer_( pacing ) {}
 
-void VideoSource::push( string_view nal, const uint64_t now )
+VideoSource::Stream& VideoSource::stream( const uint8_t stream_id )
 {
-  if ( next_nal_index_ == 0 ) {
+  if ( stream_id >= streams_.size() ) {
+    throw out_of_range( "VideoSource: stream " + to_string( stream_id ) + " out of range" );
+  }
+
+  num_streams_ = max( num_streams_, uint8_t( stream_id + 1 ) );
+  return streams_[stream_id];
+}
+
+void VideoSource::push( const EncodedFrame& frame, const uint64_t now, const uint8_t stream_id )
+{
+  if ( frame.empty() ) {
+    return;
+  }
+
+  Stream& s = stream( stream_id );
+
+  if ( frames_pushed_++ == 0 ) {
     beginning_time_ = Timer::timestamp_ns();
   }
 
-  outbound_queue_.push( { next_nal_index_++, now + frame_interval, 0, nal } );
+  const auto same_stream = [&]( const TimedNAL& queued ) { return queued.stream_id == stream_id; };
+  const auto last_in_frame
+    = [&]( const TimedNAL& queued ) { return same_stream( queued ) and queued.last_in_frame; };
+
+  /* the front slice may be partway out; the ones behind it can still be dropped */
+  const auto first_unsent = outbound_queue_.begin() + ( has_frame() and outbound_queue_.front().offset ? 1 : 0 );
+
+  /* only an IDR cuts the reference chain: an intra refresh's recovery point still refers to earlier frames */
+  const bool idr = frame.keyframe and any_of( frame.nals.begin(), frame.nals.end(), []( const auto& nal ) {
+                     return nal.type == NAL_SLICE_IDR;
+                   } );
 
-  if ( not timestamp_next_chunk_.has_value() ) {
-    timestamp_next_chunk_.emplace( now );
+  if ( idr ) {
+    /* nothing after an IDR refers to anything before it */
+    keyframes_++;
+    frames_superseded_ += count_if( first_unsent, outbound_queue_.end(), last_in_frame );
+    outbound_queue_.erase( remove_if( first_unsent, outbound_queue_.end(), same_stream ), outbound_queue_.end() );
+  } else {
+    /* no frame refers to a disposable one, so a newer frame makes it pointless */
+    const auto is_disposable = [&]( const TimedNAL& queued ) {
+      return same_stream( queued ) and queued.importance == NAL_PRIORITY_DISPOSABLE;
+    };
+    frames_superseded_ += count_if( first_unsent, outbound_queue_.end(), [&]( const TimedNAL& queued ) {
+      return is_disposable( queued ) and last_in_frame( queued );
+    } );
+    outbound_queue_.erase( remove_if( first_unsent, outbound_queue_.end(), is_disposable ), outbound_queue_.end() );
   }
-}
 
-unsigned int VideoSource::TimedNAL::num_chunks() const
-{
-  static constexpr size_t capacity = VideoChunk::Buffer::capacity();
-  const unsigned int result = nal.size() / capacity;
-  const unsigned int remainder = nal.size() % capacity;
-  return result + ( remainder ? 1 : 0 );
+  /* the recovery take_recovery() promised: requests about losses before it are covered */
+  if ( frame.recovery ) {
+    s.recovery_nal_index = s.next_nal_index;
+  }
+
+  s.recent_frames.push_back( { s.next_nal_index, frame.pts } );
+  if ( s.recent_frames.size() > recent_frames_kept ) {
+    s.recent_frames.pop_front();
+  }
+
+  /* the slices refer to the frame's buffer; the last of them to go out gives it back to its pool */
+  const PooledBuffer storage = frame.storage.empty() ? pool_->take( frame.payload ) : frame.storage;
+  const string_view payload = storage.view();
+
+  vector<string_view>& slices = frame_slices_;
+  frame.slices( slices );
+
+  for ( size_t i = 0; i < slices.size(); i++ ) {
+    outbound_queue_.push_back( { s.next_nal_index++,
+                                 stream_id,
+                                 0,
+                                 storage,
+                                 payload.substr( slices[i].data() - frame.payload.data(), slices[i].size() ),
+                                 frame.capture_timestamp,
+                                 now,
+                                 frame.keyframe,
+                                 i == 0 and ( idr or frame.recovery ),
+                                 frame.importance(),
+                                 i + 1 == slices.size() } );
+  }
+  slices_ += slices.size();
+
+  if ( frame.capture_timestamp and frame.capture_timestamp <= now ) {
+    capture_to_encoded_.record( now - frame.capture_timestamp );
+  }
 }
 
-size_t VideoSource::TimedNAL::next_chunk_size() const
+size_t VideoSource::TimedNAL::next_chunk_size( const size_t max_size ) const
 {
   if ( offset > nal.size() ) {
     throw runtime_error( "next_chunk_size(): internal error" );
   }
 
-  return min( nal.size() - offset, size_t( VideoChunk::Buffer::capacity() ) );
+  return min( nal.size() - offset, max_size );
 }
 
-string_view VideoSource::TimedNAL::next_chunk() const
+string_view VideoSource::TimedNAL::next_chunk( const size_t max_size ) const
 {
   string_view ret { nal };
-  ret = ret.substr( offset, next_chunk_size() );
-  if ( ret.size() != next_chunk_size() ) {
+  ret = ret.substr( offset, next_chunk_size( max_size ) );
+  if ( ret.size() != next_chunk_size( max_size ) ) {
     throw runtime_error( "next_chunk(): internal_error" );
   }
   return ret;
 }
 
-bool VideoSource::TimedNAL::last_chunk() const
+bool VideoSource::TimedNAL::last_chunk( const size_t max_size ) const
 {
-  return offset + next_chunk_size() == nal.size();
+  return offset + next_chunk_size( max_size ) == nal.size();
+}
+
+void VideoSource::set_max_chunk_size( const uint16_t size )
+{
+  if ( size == 0 or size > VideoChunk::Buffer::capacity() ) {
+    throw runtime_error( "VideoSource: invalid chunk size " + to_string( size ) );
+  }
+
+  max_chunk_size_ = size;
 }
 
 bool VideoSource::has_frame() const
@@ -57,25 +139,100 @@ bool VideoSource::has_frame() const
 
 bool VideoSource::ready( const uint64_t now ) const
 {
-  return has_frame() and ( now >= timestamp_next_chunk_ );
+  return has_frame() and pacer_.ready( outbound_queue_.front().next_chunk_size( max_chunk_size_ ), now );
 }
 
-void VideoSource::pop_frame()
+void VideoSource::pop_frame( const uint64_t now )
 {
   TimedNAL& nal = outbound_queue_.front();
-  nal.offset += nal.next_chunk_size();
+  const size_t chunk_size = nal.next_chunk_size( max_chunk_size_ );
+  pacer_.consume( chunk_size, now );
+  nal.offset += chunk_size;
 
   if ( nal.offset == nal.nal.size() ) {
-    outbound_queue_.pop();
+    if ( now >= nal.encoded_timestamp ) {
+      queueing_delay_.record( now - nal.encoded_timestamp );
+    }
+    outbound_queue_.pop_front();
   }
+}
 
-  if ( outbound_queue_.empty() ) {
-    timestamp_next_chunk_.reset();
-  } else {
-    timestamp_next_chunk_.value()
-      = min( outbound_queue_.front().timestamp_completion,
-             timestamp_next_chunk_.value() + frame_interval / outbound_queue_.front().num_chunks() );
+void VideoSource::request_recovery( const uint32_t last_good_nal_index,
+                                    const uint64_t now,
+                                    const uint8_t stream_id )
+{
+  Stream& s = stream( stream_id );
+  const uint32_t first_missing = last_good_nal_index == RecoveryRequest::no_nal ? 0 : last_good_nal_index + 1;
+
+  /* the receiver lost frames before the last recovery reached it: that recovery covers it (unless it has had
+     plenty of time to arrive, and was perhaps lost itself) */
+  if ( s.last_recovery_time.has_value() and first_missing < s.recovery_nal_index
+       and now < s.last_recovery_time.value() + recovery_holdoff ) {
+    recovery_requests_ignored_++;
+    return;
+  }
+
+  if ( first_missing >= s.next_nal_index ) {
+    recovery_requests_ignored_++;
+    return;
+  }
+
+  /* the frame holding the first missing NAL */
+  optional<int64_t> first_lost_pts;
+  if ( not s.recent_frames.empty() and s.recent_frames.front().first_nal_index <= first_missing ) {
+    const auto after = upper_bound(
+      s.recent_frames.begin(), s.recent_frames.end(), first_missing, []( const uint32_t nal, const SentFrame& f ) {
+        return nal < f.first_nal_index;
+      } );
+    first_lost_pts = prev( after )->pts;
+  }
+
+  /* a recovery not yet taken by the encoder goes back to whichever loss was earlier */
+  if ( s.pending_recovery.has_value() and s.pending_recovery->first_lost_pts.has_value() and first_lost_pts ) {
+    first_lost_pts = min( first_lost_pts.value(), s.pending_recovery->first_lost_pts.value() );
+  } else if ( s.pending_recovery.has_value() ) {
+    first_lost_pts.reset();
+  }
+
+  s.pending_recovery = Recovery { first_lost_pts };
+  s.last_recovery_time = now;
+}
+
+optional<VideoSource::Recovery> VideoSource::take_recovery( const uint8_t stream_id )
+{
+  Stream& s = stream( stream_id );
+  optional<Recovery> ret;
+  swap( ret, s.pending_recovery );
+  if ( ret.has_value() ) {
+    /* the next frame pushed is the recovery (or a later one, if the encoder still held some: push() moves
+       this up to the frame marked as the recovery) */
+    s.recovery_nal_index = s.next_nal_index;
+    recoveries_++;
+  }
+  return ret;
+}
+
+void VideoSource::discard_stream( const uint8_t stream_id )
+{
+  if ( stream_id >= num_streams_ ) {
+    return;
+  }
+
+  const auto first_unsent = outbound_queue_.begin() + ( has_frame() and outbound_queue_.front().offset ? 1 : 0 );
+  const auto of_stream = [&]( const TimedNAL& queued ) { return queued.stream_id == stream_id; };
+  frames_superseded_ += count_if( first_unsent, outbound_queue_.end(), [&]( const TimedNAL& queued ) {
+    return of_stream( queued ) and queued.last_in_frame;
+  } );
+  outbound_queue_.erase( remove_if( first_unsent, outbound_queue_.end(), of_stream ), outbound_queue_.end() );
+}
+
+size_t VideoSource::queued_bytes() const
+{
+  size_t ret = 0;
+  for ( const auto& nal : outbound_queue_ ) {
+    ret += nal.nal.size() - nal.offset;
   }
+  return ret;
 }
 
 uint64_t VideoSource::wait_time_ms( const uint64_t now ) const
@@ -88,7 +245,14 @@ uint64_t VideoSource::wait_time_ms( const uint64_t now ) const
     return 60'000;
   }
 
-  return ( timestamp_next_chunk_.value() - now ) / 1'000'000;
+  /* rounded up, so as not to wake up early and spin */
+  const size_t chunk_size = outbound_queue_.front().next_chunk_size( max_chunk_size_ );
+  return ( pacer_.wait_time_ns( chunk_size, now ) + 999'999 ) / 1'000'000;
+}
+
+uint32_t VideoSource::front_serialized_length() const
+{
+  return VideoChunk::header_length + outbound_queue_.front().next_chunk_size( max_chunk_size_ );
 }
 
 VideoChunk VideoSource::front( const uint32_t frame_index ) const
@@ -96,19 +260,43 @@ VideoChunk VideoSource::front( const uint32_t frame_index ) const
   VideoChunk ret;
   ret.frame_index = frame_index;
   ret.nal_index = outbound_queue_.front().nal_index;
+  ret.stream_id = outbound_queue_.front().stream_id;
+  ret.recovery_point = outbound_queue_.front().recovery_point;
 
-  ret.data.resize( outbound_queue_.front().next_chunk_size() );
-  ret.data.mutable_buffer().copy( outbound_queue_.front().next_chunk() );
+  ret.data.resize( outbound_queue_.front().next_chunk_size( max_chunk_size_ ) );
+  const string_view chunk = outbound_queue_.front().next_chunk( max_chunk_size_ );
+  copy( chunk.begin(), chunk.end(), ret.data.mutable_buffer().begin() );
 
-  ret.end_of_nal = outbound_queue_.front().last_chunk();
+  ret.end_of_nal = outbound_queue_.front().last_chunk( max_chunk_size_ );
+
+  ret.capture_timestamp = outbound_queue_.front().capture_timestamp;
+  ret.encoded_timestamp = outbound_queue_.front().encoded_timestamp;
 
   return ret;
 }
 
 void VideoSource::summary( ostream& out ) const
 {
-  out << "next NAL: " << next_nal_index_;
-  out << " fps: " << next_nal_index_ / ( double( Timer::timestamp_ns() - beginning_time_ ) / 1000000000.0 );
+  out << "next NAL: ";
+  for ( uint8_t i = 0; i < num_streams_; i++ ) {
+    out << ( i ? "/" : "" ) << streams_[i].next_nal_index;
+  }
+  out << " keyframes: " << keyframes_;
+  out << " slices/frame: " << fixed << setprecision( 1 ) << slices_ / max( 1.0, double( frames_pushed_ ) );
+  if ( frames_superseded_ ) {
+    out << " superseded: " << frames_superseded_;
+  }
+  if ( recoveries_ or recovery_requests_ignored_ ) {
+    out << " recoveries: " << recoveries_ << " (" << recovery_requests_ignored_ << " requests ignored)";
+  }
+  const double elapsed_s = double( Timer::timestamp_ns() - beginning_time_ ) / 1000000000.0;
+  out << " fps: " << frames_pushed_ / double( num_streams_ ) / elapsed_s;
+  out << "\n";
+  out << "capture->encoded: ";
+  capture_to_encoded_.summary( out );
+  out << "\n";
+  out << "queueing delay per NAL (pacer at " << pacer_.rate_bps() / 1000 << " kbps): ";
+  queueing_delay_.summary( out );
   out << "\n";
 }
 
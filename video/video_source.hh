@@ -1,44 +1,136 @@
 #pragma once
 
+#include "buffer_pool.hh"
 #include "formats.hh"
 #include "h264_encoder.hh"
+#include "histogram.hh"
+#include "pacer.hh"
 #include "summarize.hh"
+#include "timer.hh"
 #include "typed_ring_buffer.hh"
 
-#include <queue>
+#include <array>
+#include <deque>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 class VideoSource : public Summarizable
 {
   struct TimedNAL
   {
     uint32_t nal_index;
-    uint64_t timestamp_completion;
+    uint8_t stream_id;
     size_t offset;
-    std::string nal;
+    PooledBuffer storage; /* the frame's payload, shared by its slices */
+    std::string_view nal; /* within storage */
+    uint64_t capture_timestamp, encoded_timestamp;
+    bool keyframe;
+    bool recovery_point; /* the first NAL of an IDR or recovery frame */
+    uint8_t importance;  /* highest nal_ref_idc in the frame */
+    bool last_in_frame;
 
-    unsigned int num_chunks() const;
-    size_t next_chunk_size() const;
-    std::string_view next_chunk() const;
-    bool last_chunk() const;
+    /* the NAL is cut into chunks of at most max_size bytes */
+    size_t next_chunk_size( const size_t max_size ) const;
+    std::string_view next_chunk( const size_t max_size ) const;
+    bool last_chunk( const size_t max_size ) const;
   };
 
   uint64_t beginning_time_ {};
-  uint32_t next_nal_index_ {};
-  std::queue<TimedNAL> outbound_queue_ {};
-  std::optional<uint64_t> timestamp_next_chunk_ {};
+  uint32_t frames_pushed_ {};
+  std::deque<TimedNAL> outbound_queue_ {};
+  Pacer pacer_;
+  uint16_t max_chunk_size_ { max_chunk_size( default_mtu ) };
+
+  std::vector<std::string_view> frame_slices_ {};
+  std::shared_ptr<BufferPool> pool_ { BufferPool::make() }; /* for frames that don't come in a pooled buffer */
+
+  /* first NAL index and pts of recent frames, to find the frames a receiver is missing */
+  struct SentFrame
+  {
+    uint32_t first_nal_index;
+    int64_t pts;
+  };
 
 public:
-  void push( std::string_view nal, const uint64_t now );
+  struct Recovery
+  {
+    std::optional<int64_t> first_lost_pts {}; /* the first frame the receiver lacks, if still known */
+  };
+
+private:
+  /* each stream (e.g. tile) has its own encoder and its own NAL numbering */
+  struct Stream
+  {
+    uint32_t next_nal_index {};
+    std::deque<SentFrame> recent_frames {};
+
+    /* the recovery due from the encoder, when it was asked for, and the first NAL of the last one made */
+    std::optional<Recovery> pending_recovery {};
+    std::optional<uint64_t> last_recovery_time {};
+    uint32_t recovery_nal_index {};
+  };
+
+  std::array<Stream, VideoChunk::max_streams> streams_ {};
+  uint8_t num_streams_ { 1 };
+  unsigned int recoveries_ {}, recovery_requests_ignored_ {};
+
+  Stream& stream( const uint8_t stream_id );
+
+  LatencyHistogram capture_to_encoded_ {}, queueing_delay_ {}; /* the latter per NAL, until its last chunk */
+  unsigned int keyframes_ {}, frames_superseded_ {}, slices_ {};
+
+public:
+  VideoSource();
+  explicit VideoSource( const Pacer::Config& pacing );
+
+  /* queue an encoded frame (`now` is when encoding finished), one NAL per slice so that each can be
+     decoded as soon as it is complete. The slices keep a reference to the frame's storage rather than a
+     copy (which is made only if the frame has none). Queued slices that haven't started going out are dropped once
+     nothing can need them: all of them on an IDR, and those of disposable (non-reference) frames on
+     any newer frame (of the same stream). */
+  void push( const EncodedFrame& frame, const uint64_t now, const uint8_t stream_id = 0 );
+
+  /* a receiver lost frames of a stream for good after `last_good_nal_index` (RecoveryRequest::no_nal: from
+     the start). Requests that were sent before the receiver could have seen the last recovery are ignored,
+     so a burst of them yields one recovery frame. */
+  void request_recovery( const uint32_t last_good_nal_index, const uint64_t now, const uint8_t stream_id = 0 );
+
+  /* for whoever drives the stream's encoder, to pass on to H264Encoder::recover() */
+  std::optional<Recovery> take_recovery( const uint8_t stream_id = 0 );
+
+  /* drop the stream's queued NALs that haven't started going out (e.g. when its encoder is stopped) */
+  void discard_stream( const uint8_t stream_id );
+
+  /* drop everything queued, e.g. with nowhere to send it; as nothing goes out, the pacer isn't charged */
+  void discard_queued() { outbound_queue_.clear(); }
+
+  uint8_t num_streams() const { return num_streams_; }
+
+  /* queued frames dropped unsent because nothing could need them any more */
+  unsigned int frames_superseded() const { return frames_superseded_; }
+
+  /* encoded bytes waiting to go out */
+  size_t queued_bytes() const;
+
+  /* chunks go out as the pacer allows: at once within its burst allowance, then spaced at its rate */
+  void set_pacing_rate( const uint64_t rate_bps, const uint64_t now ) { pacer_.set_rate( rate_bps, now ); }
+  uint64_t pacing_rate_bps() const { return pacer_.rate_bps(); }
+  void reset_pacing( const uint64_t rate_bps, const uint64_t now ) { pacer_.reset( rate_bps, now ); }
+
+  /* chunks are cut to this size as they go out, e.g. max_chunk_size() of the path MTU */
+  void set_max_chunk_size( const uint16_t size );
 
   uint64_t wait_time_ms( const uint64_t now ) const;
   bool ready( const uint64_t now ) const;
 
   /* for these methods (used by the templated NetworkSender), "frame" refers to a VideoChunk */
   bool has_frame() const;
-  void pop_frame();
+  void pop_frame() { pop_frame( Timer::timestamp_ns() ); }
+  void pop_frame( const uint64_t now );
   VideoChunk front( const uint32_t frame_index ) const;
+  uint32_t front_serialized_length() const; /* without making it */
 
   void summary( std::ostream& out ) const override;
 };
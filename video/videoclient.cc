@@ -1,9 +1,25 @@
 #include "videoclient.hh"
 #include "connection.hh"
 
+#include <iostream>
+
 using namespace std;
 using namespace std::chrono;
 
+/* what the kernel knows of the path MTU, from connecting a UDP socket (which sends nothing), or the usual
+   Ethernet MTU if it can't say */
+static unsigned int probe_mtu( const Address& destination )
+{
+  try {
+    UDPSocket probe;
+    probe.connect( destination );
+    return probe.mtu();
+  } catch ( const exception& e ) {
+    cerr << "MTU probe failed (" << e.what() << "), assuming " << default_mtu << " bytes\n";
+    return default_mtu;
+  }
+}
+
 VideoClient::NetworkSession::NetworkSession( const uint8_t node_id,
                                              const KeyPair& session_key,
                                              const Address& destination )
@@ -12,21 +28,59 @@ VideoClient::NetworkSession::NetworkSession( const uint8_t node_id,
 
 void VideoClient::NetworkSession::transmit_frame( VideoSource& source, UDPSocket& socket )
 {
+  if ( not connection.coalescing() ) {
+    connection.push_frame( source );
+    connection.send_packet( socket );
+    return;
+  }
+
+  /* send what is waiting if this chunk can't join it, and send straight away once the packet is full */
+  if ( not connection.has_room_for( source.front_serialized_length() ) ) {
+    connection.send_packet( socket );
+  }
+
   connection.push_frame( source );
-  connection.send_packet( socket );
+
+  if ( connection.packet_full() ) {
+    connection.send_packet( socket );
+  }
 }
 
-void VideoClient::NetworkSession::network_receive( const Ciphertext& ciphertext )
+void VideoClient::NetworkSession::network_receive( const Ciphertext& ciphertext,
+                                                   VideoSource& source,
+                                                   const RecoveryHandler& recovered )
 {
   connection.receive_packet( ciphertext );
 
+  /* the source paces its chunks at the congestion controller's rate */
+  source.set_pacing_rate( connection.congestion_controller()->pacing_rate_bps(), Timer::timestamp_ns() );
+
   if ( connection.has_inbound_unreliable_data() ) {
     Parser p { connection.inbound_unreliable_data() };
+    RecoveryRequest request;
+    p.object( request );
     if ( p.error() ) {
       p.clear_error();
+    } else {
+      /* a stream the receiver hasn't heard from at all is missing everything */
+      for ( uint8_t i = 0; i < source.num_streams(); i++ ) {
+        const uint32_t last_good = i < request.last_good_nal_indices.length
+                                     ? uint32_t( request.last_good_nal_indices.elements[i] )
+                                     : RecoveryRequest::no_nal;
+        source.request_recovery( last_good, Timer::timestamp_ns(), i );
+      }
     }
     connection.pop_inbound_unreliable_data();
   }
+
+  /* with no handler yet, recoveries wait in the source */
+  if ( recovered ) {
+    for ( uint8_t i = 0; i < source.num_streams(); i++ ) {
+      if ( const auto recovery = source.take_recovery( i ) ) {
+        recovered( i, recovery.value() );
+      }
+    }
+  }
 }
 
 void VideoClient::NetworkSession::summary( std::ostream& out ) const
@@ -48,6 +102,12 @@ void VideoClient::process_keyreply( const Ciphertext& ciphertext )
       return;
     }
     session_.emplace( keys.id, keys.key_pair, server_ );
+    session_->connection.set_congestion_controller( make_unique<DelayGradientController>() );
+    session_->connection.set_mtu( mtu_ );
+    session_->connection.set_coalescing( coalescing_deadline_ns_ );
+    /* a new connection starts with a full bucket, whatever the last one left */
+    source_->reset_pacing( session_->connection.congestion_controller()->pacing_rate_bps(),
+                           Timer::timestamp_ns() );
     stats_.new_sessions++;
   } else {
     stats_.bad_packets++;
@@ -62,9 +122,11 @@ VideoClient::VideoClient( const Address& server,
   , name_( key.name() )
   , long_lived_crypto_( key.key_pair().uplink, key.key_pair().downlink, true )
   , source_( source )
+  , mtu_( probe_mtu( server ) )
   , next_key_request_( steady_clock::now() )
 {
   socket_.set_blocking( false );
+  set_mtu( mtu_ );
 
   loop.add_rule(
     "network transmit",
@@ -75,14 +137,24 @@ VideoClient::VideoClient( const Address& server,
         session_.reset();
       }
     },
-    [&] { return source_->ready( Timer::timestamp_ns() ) and session_.has_value(); } );
+    [&] {
+      const uint64_t now = Timer::timestamp_ns();
+      return session_.has_value() and source_->ready( now ) and session_->connection.ready_to_send( now );
+    } );
+
+  loop.add_rule(
+    "network flush coalesced",
+    [&] { session_->connection.send_packet( socket_ ); },
+    [&] {
+      const uint64_t now = Timer::timestamp_ns();
+      return session_.has_value() and session_->connection.coalesced_packet_due( now )
+             and session_->connection.ready_to_send( now );
+    } );
 
   loop.add_rule(
     "discard video",
     [&] {
-      while ( source_->has_frame() ) {
-        source_->pop_frame();
-      }
+      source_->discard_queued();
     },
     [&] { return source_->has_frame() and not session_.has_value(); } );
 
@@ -100,7 +172,8 @@ VideoClient::VideoClient( const Address& server,
           break;
         case 0:
           if ( session_.has_value() ) {
-            session_->network_receive( ciphertext );
+            session_->network_receive( ciphertext, *source_, recovery_handler_ );
+            adapt_bitrate( Timer::timestamp_ns() );
           }
           break;
         default:
@@ -126,6 +199,67 @@ VideoClient::VideoClient( const Address& server,
     [&] { return ( !session_.has_value() ) and ( next_key_request_ < steady_clock::now() ); } );
 }
 
+void VideoClient::set_mtu( const unsigned int mtu )
+{
+  if ( mtu < min_mtu ) {
+    throw runtime_error( "VideoClient: MTU " + to_string( mtu ) + " is too small" );
+  }
+
+  mtu_ = mtu;
+  source_->set_max_chunk_size( max_chunk_size( mtu_ ) );
+  if ( session_.has_value() ) {
+    session_->connection.set_mtu( mtu_ );
+    session_->connection.set_coalescing( coalescing_deadline_ns_ );
+  }
+}
+
+void VideoClient::set_coalescing( const optional<uint64_t> deadline_ns )
+{
+  coalescing_deadline_ns_ = deadline_ns;
+  if ( session_.has_value() ) {
+    session_->connection.set_coalescing( coalescing_deadline_ns_ );
+  }
+}
+
+void VideoClient::set_bitrate_handler( BitrateHandler handler, const BitrateAdapter::Config& config )
+{
+  bitrate_adapter_.emplace( config );
+  bitrate_handler_ = move( handler );
+  bitrate_kbps_.reset();
+}
+
+void VideoClient::adapt_bitrate( const uint64_t now )
+{
+  if ( not bitrate_handler_ ) {
+    return;
+  }
+
+  /* the adapter decides at most once an interval, and starts over when a new session resets the counters */
+  bitrate_adapter_->update( BitrateAdapter::sample( session_->connection.sender_stats(), now ) );
+
+  /* never more than the congestion controller will let through (it leaves room for retransmissions) */
+  const unsigned int kbps = min( bitrate_adapter_->target_kbps(), max( 1u, target_bitrate_kbps().value() ) );
+  if ( kbps != bitrate_kbps_ ) {
+    bitrate_kbps_ = kbps;
+    bitrate_handler_( kbps );
+  }
+}
+
+uint64_t VideoClient::wait_time_ms( const uint64_t now ) const
+{
+  if ( not session_.has_value() ) {
+    return source_->wait_time_ms( now );
+  }
+
+  /* video to send, but the congestion controller is holding it back */
+  if ( source_->ready( now ) or session_->connection.coalesced_packet_due( now ) ) {
+    return session_->connection.send_wait_time_ms( now );
+  }
+
+  /* or chunks waiting for others to join them */
+  return min( source_->wait_time_ms( now ), session_->connection.coalescing_wait_ms( now ) );
+}
+
 void VideoClient::summary( ostream& out ) const
 {
   out << "Peer [" << name_ << "]:";
@@ -136,4 +270,7 @@ void VideoClient::summary( ostream& out ) const
   if ( session_.has_value() ) {
     session_->summary( out );
   }
+  if ( bitrate_adapter_.has_value() ) {
+    bitrate_adapter_->summary( out );
+  }
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
 
+#include "bitrate_adapter.hh"
 #include "connection.hh"
 #include "keys.hh"
 #include "video_source.hh"
@@ -10,6 +12,11 @@ using VideoNetworkConnection = NetworkConnection<VideoChunk, VideoSource>;
 
 class VideoClient : public Summarizable
 {
+public:
+  using RecoveryHandler = std::function<void( uint8_t stream_id, const VideoSource::Recovery& recovery )>;
+  using BitrateHandler = std::function<void( unsigned int kbps )>;
+
+private:
   struct NetworkSession
   {
     VideoNetworkConnection connection;
@@ -17,7 +24,7 @@ class VideoClient : public Summarizable
     NetworkSession( const uint8_t node_id, const KeyPair& session_key, const Address& destination );
 
     void transmit_frame( VideoSource& source, UDPSocket& socket );
-    void network_receive( const Ciphertext& ciphertext );
+    void network_receive( const Ciphertext& ciphertext, VideoSource& source, const RecoveryHandler& recovered );
     void decode();
     void summary( std::ostream& out ) const;
   };
@@ -33,6 +40,16 @@ class VideoClient : public Summarizable
 
   std::shared_ptr<VideoSource> source_;
 
+  unsigned int mtu_; /* of the path to the server: each packet fills one datagram of it */
+  std::optional<uint64_t> coalescing_deadline_ns_ {};
+  RecoveryHandler recovery_handler_ {};
+
+  std::optional<BitrateAdapter> bitrate_adapter_ {};
+  BitrateHandler bitrate_handler_ {};
+  std::optional<unsigned int> bitrate_kbps_ {}; /* the last target given to the handler */
+
+  void adapt_bitrate( const uint64_t now );
+
   void process_keyreply( const Ciphertext& ciphertext );
   std::chrono::steady_clock::time_point next_key_request_;
 
@@ -49,5 +66,43 @@ public:
 
   void summary( std::ostream& out ) const override;
 
-  uint64_t wait_time_ms( const uint64_t now ) const { return source_->wait_time_ms( now ); }
+  uint64_t wait_time_ms( const uint64_t now ) const;
+
+  /* the MTU starts out as what the kernel knows of the path to the server; override it (e.g. for a tunnel) */
+  void set_mtu( const unsigned int mtu );
+  unsigned int mtu() const { return mtu_; }
+
+  /* pack several chunks into a packet when they are small (e.g. the ends of NALs), holding each back for up
+     to the deadline for more to join it; fewer packets (and encryptions and syscalls), for a little latency.
+     Off (one packet per chunk) by default. */
+  void set_coalescing( const std::optional<uint64_t> deadline_ns );
+
+  /* when the receiver asks for a stream to recover, hand the recovery to whoever drives that stream's encoder,
+     to pass on to H264Encoder::recover() (through EncoderThread::post(), if the encoder has a thread of its
+     own). A burst of requests for the same loss makes one call. */
+  void set_recovery_handler( RecoveryHandler handler ) { recovery_handler_ = std::move( handler ); }
+
+  /* pick the encoder's target bitrate with a BitrateAdapter, fed with the sender's statistics as ACKs come
+     in and capped at target_bitrate_kbps(), and hand each new target to whoever drives the encoder, for
+     H264Encoder::set_target_bitrate() (through EncoderThread::post(), if the encoder has a thread of its own) */
+  void set_bitrate_handler( BitrateHandler handler, const BitrateAdapter::Config& config = {} );
+
+  /* the current session's sender statistics, if there is a session */
+  std::optional<NetworkSender<VideoChunk>::Statistics> sender_stats() const
+  {
+    if ( not session_.has_value() ) {
+      return {};
+    }
+    return session_->connection.sender_stats();
+  }
+
+  /* the congestion controller's target for the encoder, if there is a session: the cap on what the bitrate
+     handler is given */
+  std::optional<unsigned int> target_bitrate_kbps() const
+  {
+    if ( not session_.has_value() ) {
+      return {};
+    }
+    return session_->connection.congestion_controller()->target_rate_bps() / 1000;
+  }
 };
@@ -0,0 +1,198 @@
+#include "yuyv_to_i420.hh"
+
+#include <stdexcept>
+#include <string>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define YUYV_TO_I420_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/* one pair of rows: the scalar version, also used for the tails the vector loops leave over */
+static void convert_rows_scalar( const uint8_t* row0,
+                                 const uint8_t* row1,
+                                 uint8_t* y0,
+                                 uint8_t* y1,
+                                 uint8_t* u,
+                                 uint8_t* v,
+                                 const unsigned int first_pixel,
+                                 const unsigned int width )
+{
+  for ( unsigned int x = first_pixel; x < width; x += 2 ) {
+    const unsigned int i = 2 * x;
+    y0[x] = row0[i];
+    y0[x + 1] = row0[i + 2];
+    y1[x] = row1[i];
+    y1[x + 1] = row1[i + 2];
+    u[x / 2] = ( row0[i + 1] + row1[i + 1] + 1 ) >> 1;
+    v[x / 2] = ( row0[i + 3] + row1[i + 3] + 1 ) >> 1;
+  }
+}
+
+#ifdef YUYV_TO_I420_X86
+
+/* 16 pixels per row per iteration */
+__attribute__( ( target( "sse2" ) ) ) static unsigned int convert_rows_sse2( const uint8_t* row0,
+                                                                            const uint8_t* row1,
+                                                                            uint8_t* y0,
+                                                                            uint8_t* y1,
+                                                                            uint8_t* u,
+                                                                            uint8_t* v,
+                                                                            const unsigned int width )
+{
+  const __m128i low_bytes = _mm_set1_epi16( 0x00FF );
+
+  unsigned int x = 0;
+  for ( ; x + 16 <= width; x += 16 ) {
+    const __m128i a0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row0 + 2 * x ) );
+    const __m128i a1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row0 + 2 * x + 16 ) );
+    const __m128i b0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row1 + 2 * x ) );
+    const __m128i b1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row1 + 2 * x + 16 ) );
+
+    /* luma: the even bytes */
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( y0 + x ),
+                      _mm_packus_epi16( _mm_and_si128( a0, low_bytes ), _mm_and_si128( a1, low_bytes ) ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( y1 + x ),
+                      _mm_packus_epi16( _mm_and_si128( b0, low_bytes ), _mm_and_si128( b1, low_bytes ) ) );
+
+    /* chroma: the odd bytes, averaged across the two rows => U0 V0 U1 V1 ... */
+    const __m128i uv = _mm_packus_epi16( _mm_srli_epi16( _mm_avg_epu8( a0, b0 ), 8 ),
+                                         _mm_srli_epi16( _mm_avg_epu8( a1, b1 ), 8 ) );
+
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storel_epi64( reinterpret_cast<__m128i*>( u + x / 2 ),
+                      _mm_packus_epi16( _mm_and_si128( uv, low_bytes ), zero ) );
+    _mm_storel_epi64( reinterpret_cast<__m128i*>( v + x / 2 ), _mm_packus_epi16( _mm_srli_epi16( uv, 8 ), zero ) );
+  }
+
+  return x;
+}
+
+/* 32 pixels per row per iteration (packs work per 128-bit lane, hence the permutes) */
+__attribute__( ( target( "avx2" ) ) ) static unsigned int convert_rows_avx2( const uint8_t* row0,
+                                                                            const uint8_t* row1,
+                                                                            uint8_t* y0,
+                                                                            uint8_t* y1,
+                                                                            uint8_t* u,
+                                                                            uint8_t* v,
+                                                                            const unsigned int width )
+{
+  const __m256i low_bytes = _mm256_set1_epi16( 0x00FF );
+
+  unsigned int x = 0;
+  for ( ; x + 32 <= width; x += 32 ) {
+    const __m256i a0 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row0 + 2 * x ) );
+    const __m256i a1 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row0 + 2 * x + 32 ) );
+    const __m256i b0 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row1 + 2 * x ) );
+    const __m256i b1 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row1 + 2 * x + 32 ) );
+
+    const __m256i luma0
+      = _mm256_packus_epi16( _mm256_and_si256( a0, low_bytes ), _mm256_and_si256( a1, low_bytes ) );
+    const __m256i luma1
+      = _mm256_packus_epi16( _mm256_and_si256( b0, low_bytes ), _mm256_and_si256( b1, low_bytes ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( y0 + x ), _mm256_permute4x64_epi64( luma0, 0xD8 ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( y1 + x ), _mm256_permute4x64_epi64( luma1, 0xD8 ) );
+
+    /* U0 V0 U1 V1 ... U15 V15, then U | V within each lane, then all the U and all the V together */
+    const __m256i uv = _mm256_permute4x64_epi64(
+      _mm256_packus_epi16( _mm256_srli_epi16( _mm256_avg_epu8( a0, b0 ), 8 ),
+                           _mm256_srli_epi16( _mm256_avg_epu8( a1, b1 ), 8 ) ),
+      0xD8 );
+    const __m256i split = _mm256_packus_epi16( _mm256_and_si256( uv, low_bytes ), _mm256_srli_epi16( uv, 8 ) );
+    const __m256i planar = _mm256_permute4x64_epi64( split, 0xD8 );
+
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( u + x / 2 ), _mm256_castsi256_si128( planar ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( v + x / 2 ), _mm256_extracti128_si256( planar, 1 ) );
+  }
+
+  return x;
+}
+
+#endif
+
+YUYVToI420::Kernel YUYVToI420::best_kernel()
+{
+  static const Kernel best = [] {
+    if ( supported( Kernel::AVX2 ) ) {
+      return Kernel::AVX2;
+    } else if ( supported( Kernel::SSE2 ) ) {
+      return Kernel::SSE2;
+    }
+    return Kernel::Scalar;
+  }();
+
+  return best;
+}
+
+bool YUYVToI420::supported( const Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar:
+      return true;
+#ifdef YUYV_TO_I420_X86
+    case Kernel::SSE2:
+      return __builtin_cpu_supports( "sse2" );
+    case Kernel::AVX2:
+      return __builtin_cpu_supports( "avx2" );
+#endif
+    default:
+      return false;
+  }
+}
+
+string_view YUYVToI420::name( const Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar:
+      return "scalar";
+    case Kernel::SSE2:
+      return "SSE2";
+    case Kernel::AVX2:
+      return "AVX2";
+  }
+
+  return "unknown";
+}
+
+void YUYVToI420::convert( const Kernel kernel,
+                          const uint8_t* yuyv,
+                          const unsigned int yuyv_stride,
+                          const Destination& dest,
+                          const unsigned int width,
+                          const unsigned int height )
+{
+  if ( width % 2 or height % 2 ) {
+    throw runtime_error( "YUYVToI420: width and height must be even" );
+  }
+
+  if ( not supported( kernel ) ) {
+    throw runtime_error( "YUYVToI420: " + string( name( kernel ) ) + " kernel not supported on this CPU" );
+  }
+
+  for ( unsigned int row = 0; row < height; row += 2 ) {
+    const uint8_t* row0 = yuyv + size_t( row ) * yuyv_stride;
+    const uint8_t* row1 = row0 + yuyv_stride;
+    uint8_t* y0 = dest.y + size_t( row ) * dest.y_stride;
+    uint8_t* y1 = y0 + dest.y_stride;
+    uint8_t* u = dest.u + size_t( row / 2 ) * dest.u_stride;
+    uint8_t* v = dest.v + size_t( row / 2 ) * dest.v_stride;
+
+    unsigned int done = 0;
+    switch ( kernel ) {
+#ifdef YUYV_TO_I420_X86
+      case Kernel::AVX2:
+        done = convert_rows_avx2( row0, row1, y0, y1, u, v, width );
+        break;
+      case Kernel::SSE2:
+        done = convert_rows_sse2( row0, row1, y0, y1, u, v, width );
+        break;
+#endif
+      default:
+        break;
+    }
+
+    convert_rows_scalar( row0, row1, y0, y1, u, v, done, width );
+  }
+}
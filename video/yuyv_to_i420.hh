@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/* packed YUYV 4:2:2 => planar I420, the one conversion on the capture hot path.
+   Luma is copied; each chroma sample is the rounded average of the two rows it
+   covers (what pavgb gives, and what swscale's unscaled YUYV => YUV420P path does). */
+class YUYVToI420
+{
+public:
+  enum class Kernel
+  {
+    Scalar,
+    SSE2,
+    AVX2
+  };
+
+  struct Destination
+  {
+    uint8_t *y, *u, *v;
+    unsigned int y_stride, u_stride, v_stride;
+  };
+
+  /* best kernel this CPU can run (checked once, at runtime) */
+  static Kernel best_kernel();
+  static bool supported( const Kernel kernel );
+  static std::string_view name( const Kernel kernel );
+
+  /* width and height must be even */
+  static void convert( const Kernel kernel,
+                       const uint8_t* yuyv,
+                       const unsigned int yuyv_stride,
+                       const Destination& dest,
+                       const unsigned int width,
+                       const unsigned int height );
+};